@@ -0,0 +1,188 @@
+#pragma once
+
+// Asynchronous logging for the MPI programs.
+//
+// Every process owns one channel: the thread that logs formats each record straight
+// into a slot of a lock-free single-producer ring, and a background thread drains the
+// ring into <name>.<rank>.log. Logging never blocks and never flushes on the caller's
+// thread; when the ring is full the record is dropped and counted instead.
+//
+// Levels below LOG_LEVEL are removed by the preprocessor, arguments included, so
+// disabled logging costs nothing. Define LOG_LEVEL to one of the LOG_LEVEL_* values,
+// e.g. -DLOG_LEVEL=LOG_LEVEL_DEBUG; the default keeps INFO and above.
+//
+// Only one thread may log. The drainer doesn't call MPI, so MPI_THREAD_FUNNELED suffices.
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) ::logging::channel::get().write(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) ::logging::channel::get().write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) ::logging::channel::get().write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) ::logging::channel::get().write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) ::logging::channel::get().write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define LOG_PRINTF_FORMAT(fmt, args)
+#endif
+
+namespace logging {
+
+class channel {
+public:
+	// Number of records the ring holds, a power of two
+	static constexpr std::size_t CAPACITY{1 << 14};
+	// Longer messages are truncated
+	static constexpr std::size_t TEXT_SIZE{116};
+
+	static channel& get() {
+		static channel instance;
+		return instance;
+	}
+
+	// Starts draining into <name>.<rank>.log. Records written before open() are dropped.
+	void open(const std::string& name, int rank) {
+		if (LOG_LEVEL >= LOG_LEVEL_OFF || is_running.load(std::memory_order_relaxed)) return;
+		const std::string path{name + "." + std::to_string(rank) + ".log"};
+		file = std::fopen(path.c_str(), "w");
+		if (file == nullptr) return;
+		epoch = std::chrono::steady_clock::now();
+		is_running.store(true, std::memory_order_release);
+		drainer = std::thread(&channel::drain, this);
+	}
+
+	// Writes the remaining records and stops the drainer.
+	void close() {
+		if (!is_running.load(std::memory_order_relaxed)) return;
+		is_running.store(false, std::memory_order_release);
+		drainer.join();
+		const long lost{dropped.load(std::memory_order_relaxed)};
+		if (lost > 0) {
+			std::fprintf(file, "%ld records dropped, the ring was full\n", lost);
+		}
+		std::fclose(file);
+		file = nullptr;
+	}
+
+	LOG_PRINTF_FORMAT(3, 4) void write(int level, const char* format, ...) {
+		if (!is_running.load(std::memory_order_relaxed)) return;
+		const std::size_t h{head.load(std::memory_order_relaxed)};
+		if (h - tail.load(std::memory_order_acquire) == CAPACITY) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		record& r{records[h & (CAPACITY - 1)]};
+		r.time = std::chrono::steady_clock::now();
+		r.level = level;
+		va_list args;
+		va_start(args, format);
+		std::vsnprintf(r.text, TEXT_SIZE, format, args);
+		va_end(args);
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	~channel() {
+		close();
+	}
+
+private:
+	struct record {
+		std::chrono::steady_clock::time_point time;
+		int level;
+		char text[TEXT_SIZE];
+	};
+
+	channel(): records{new record[CAPACITY]} {}
+	channel(const channel&) = delete;
+	channel& operator=(const channel&) = delete;
+
+	// Writes out what the ring holds, returns the number of records written.
+	std::size_t drain_once() {
+		static const char* names[]{"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+		const std::size_t h{head.load(std::memory_order_acquire)};
+		std::size_t t{tail.load(std::memory_order_relaxed)};
+		const std::size_t count{h - t};
+		for (; t != h; ++t) {
+			const record& r{records[t & (CAPACITY - 1)]};
+			const std::chrono::duration<double> since{r.time - epoch};
+			std::fprintf(file, "%12.6f %-5s %s\n", since.count(), names[r.level], r.text);
+			// Hand the slot back right away, so a long drain doesn't stall the producer
+			tail.store(t + 1, std::memory_order_release);
+		}
+		return count;
+	}
+
+	void drain() {
+		while (is_running.load(std::memory_order_acquire)) {
+			if (drain_once() > 0) {
+				std::fflush(file);
+			} else {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		// The producer is done, catch up with its last records
+		drain_once();
+		std::fflush(file);
+	}
+
+	std::unique_ptr<record[]> records;
+	// Written by the producer only
+	alignas(64) std::atomic<std::size_t> head{0};
+	// Written by the drainer only
+	alignas(64) std::atomic<std::size_t> tail{0};
+	alignas(64) std::atomic<long> dropped{0};
+	std::atomic<bool> is_running{false};
+	std::FILE* file{nullptr};
+	std::chrono::steady_clock::time_point epoch;
+	std::thread drainer;
+};
+
+inline void open(const std::string& name, int rank) {
+	channel::get().open(name, rank);
+}
+
+inline void close() {
+	channel::get().close();
+}
+
+}
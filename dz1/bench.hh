@@ -0,0 +1,156 @@
+#pragma once
+
+// Workload options and metrics shared by the philosopher benchmarks.
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+// Returns a random integer in the specified range.
+inline long rand_between(std::mt19937& gen, long min, long max) {
+	std::uniform_int_distribution<long> dist(min, max);
+	return dist(gen);
+}
+
+struct options {
+	// Silent run that only prints the summary
+	bool bench{false};
+	// Think and eat durations in milliseconds, drawn uniformly from [min, max]
+	long think_min{200};
+	long think_max{3000};
+	long eat_min{0};
+	long eat_max{0};
+	// Stop after this many meals per philosopher, 0 means never
+	long meals{0};
+	// Stop becoming hungry after this many seconds, 0 means never
+	double seconds{0.0};
+	// Every philosopher seeds its generator with seed + its id
+	bool is_seed_set{false};
+	unsigned long seed{0};
+};
+
+inline const char* common_usage() {
+	return "[--bench] [--think <min_ms> <max_ms>] [--eat <min_ms> <max_ms>] [--meals <count>] [--seconds <duration>] [--seed <seed>]";
+}
+
+// Consumes the option at argv[i] (and its values) if it is one of the common options.
+inline bool parse_common_option(options& opts, int argc, char* argv[], int& i) {
+	const std::string arg{argv[i]};
+	const int remaining{argc - i - 1};
+	if (arg == "--bench") {
+		opts.bench = true;
+	} else if (arg == "--think" && remaining >= 2) {
+		opts.think_min = std::atol(argv[++i]);
+		opts.think_max = std::atol(argv[++i]);
+	} else if (arg == "--eat" && remaining >= 2) {
+		opts.eat_min = std::atol(argv[++i]);
+		opts.eat_max = std::atol(argv[++i]);
+	} else if (arg == "--meals" && remaining >= 1) {
+		opts.meals = std::atol(argv[++i]);
+	} else if (arg == "--seconds" && remaining >= 1) {
+		opts.seconds = std::atof(argv[++i]);
+	} else if (arg == "--seed" && remaining >= 1) {
+		opts.is_seed_set = true;
+		opts.seed = std::strtoul(argv[++i], nullptr, 10);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+inline void check_options(const options& opts) {
+	if (opts.think_min < 0 || opts.think_max < opts.think_min || opts.eat_min < 0 || opts.eat_max < opts.eat_min) {
+		throw std::invalid_argument("durations must satisfy 0 <= min <= max");
+	}
+}
+
+inline options parse_options(int argc, char* argv[]) {
+	options opts;
+	for (int i{1}; i < argc; ++i) {
+		if (!parse_common_option(opts, argc, argv, i)) {
+			throw std::invalid_argument(std::string{"unknown or incomplete option: "} + argv[i]);
+		}
+	}
+	check_options(opts);
+	return opts;
+}
+
+inline std::mt19937 make_generator(const options& opts, int id) {
+	std::mt19937 gen;
+	if (opts.is_seed_set) {
+		gen.seed(opts.seed + id);
+	} else {
+		gen.seed(std::random_device{}());
+	}
+	return gen;
+}
+
+// Log-scale latency histogram in microseconds. Bucket 0 holds everything below 1 us,
+// bucket b > 0 holds [2^((b-1)/PER_OCTAVE), 2^(b/PER_OCTAVE)). Histograms of all philosophers are summed.
+struct latency_histogram {
+	static constexpr int BUCKETS{128};
+	static constexpr int PER_OCTAVE{4};
+	long counts[BUCKETS]{};
+
+	void add(double us) {
+		int bucket{0};
+		if (us >= 1.0) {
+			bucket = std::min(BUCKETS - 1, static_cast<int>(PER_OCTAVE * std::log2(us)) + 1);
+		}
+		counts[bucket]++;
+	}
+
+	void merge(const latency_histogram& other) {
+		for (int bucket{0}; bucket < BUCKETS; ++bucket) {
+			counts[bucket] += other.counts[bucket];
+		}
+	}
+
+	// Upper edge of the bucket that contains the p-th percentile, p in [0, 100]
+	double percentile(double p) const {
+		long total{0};
+		for (const long count : counts) total += count;
+		if (total == 0) return 0.0;
+		const double rank{p / 100.0 * total};
+		long seen{0};
+		for (int bucket{0}; bucket < BUCKETS; ++bucket) {
+			seen += counts[bucket];
+			if (seen >= rank && seen > 0) {
+				return std::exp2(static_cast<double>(bucket) / PER_OCTAVE);
+			}
+		}
+		return std::exp2(static_cast<double>(BUCKETS - 1) / PER_OCTAVE);
+	}
+};
+
+// Metrics of a whole run, combined over all philosophers
+struct summary {
+	int philosophers{0};
+	// Longest run time of a philosopher in seconds
+	double elapsed{0.0};
+	long meals{0};
+	long min_meals{0};
+	long max_meals{0};
+	// Fork request to grant latency
+	double wait_total_ms{0.0};
+	long wait_count{0};
+	// Time from becoming hungry to eating
+	latency_histogram acquisition;
+};
+
+inline void print_summary(std::ostream& out, const summary& s, const char* meal_name = "meals") {
+	out << "philosophers: " << s.philosophers << std::endl;
+	out << "elapsed: " << s.elapsed << " s" << std::endl;
+	out << meal_name << ": " << s.meals << " (min " << s.min_meals << ", max " << s.max_meals << " per philosopher)" << std::endl;
+	out << meal_name << " per second: " << s.meals / s.elapsed << std::endl;
+	if (s.wait_count > 0) {
+		out << "average fork wait: " << s.wait_total_ms / s.wait_count << " ms" << std::endl;
+	}
+	out << "time to eat p50/p90/p99/max: "
+		<< s.acquisition.percentile(50) << " / " << s.acquisition.percentile(90) << " / "
+		<< s.acquisition.percentile(99) << " / " << s.acquisition.percentile(100) << " us" << std::endl;
+}
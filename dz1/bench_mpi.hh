@@ -0,0 +1,22 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "bench.hh"
+
+// Combines the metrics of every rank of comm. The result is only valid on rank 0.
+inline summary reduce_summary(long meals, double elapsed, double wait_total_ms, long wait_count, const latency_histogram& acquisition, MPI_Comm comm) {
+	summary s;
+	MPI_Comm_size(comm, &s.philosophers);
+	double wait_sums[2]{wait_total_ms, static_cast<double>(wait_count)};
+	double total_wait_sums[2]{0.0, 0.0};
+	MPI_Reduce(&meals, &s.meals, 1, MPI_LONG, MPI_SUM, 0, comm);
+	MPI_Reduce(&meals, &s.min_meals, 1, MPI_LONG, MPI_MIN, 0, comm);
+	MPI_Reduce(&meals, &s.max_meals, 1, MPI_LONG, MPI_MAX, 0, comm);
+	MPI_Reduce(&elapsed, &s.elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+	MPI_Reduce(wait_sums, total_wait_sums, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+	MPI_Reduce(acquisition.counts, s.acquisition.counts, latency_histogram::BUCKETS, MPI_LONG, MPI_SUM, 0, comm);
+	s.wait_total_ms = total_wait_sums[0];
+	s.wait_count = static_cast<long>(total_wait_sums[1]);
+	return s;
+}
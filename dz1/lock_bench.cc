@@ -0,0 +1,172 @@
+#include <iostream>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <mpi.h>
+
+#include "bench.hh"
+#include "bench_mpi.hh"
+#include "resource_lock.hh"
+
+struct topology_options {
+	// "ring" or "random"
+	std::string topology{"ring"};
+	// Average number of neighbors in a random graph
+	double degree{4.0};
+	// Probability that a session needs each of the rank's resources
+	double subset{1.0};
+};
+
+// Builds the conflict graph from a generator seeded the same way on every rank
+// and returns the edges of the given rank.
+std::vector<shared_resource> build_graph(const topology_options& topo, unsigned long seed, int id, int size) {
+	std::vector<shared_resource> resources;
+	if (topo.topology == "ring") {
+		// Resource i is shared by ranks i and i + 1, as the forks of dz1
+		resources.push_back(shared_resource{id, (id - 1 + size) % size});
+		resources.push_back(shared_resource{(id + 1) % size, (id + 1) % size});
+	} else if (topo.topology == "random") {
+		std::mt19937 gen(seed);
+		std::bernoulli_distribution has_edge(size > 1 ? std::min(1.0, topo.degree / (size - 1)) : 0.0);
+		int resource_id{0};
+		for (int a{0}; a < size; ++a) {
+			for (int b{a + 1}; b < size; ++b) {
+				if (!has_edge(gen)) continue;
+				if (a == id) resources.push_back(shared_resource{resource_id, b});
+				if (b == id) resources.push_back(shared_resource{resource_id, a});
+				resource_id++;
+			}
+		}
+	} else {
+		throw std::invalid_argument("unknown topology: " + topo.topology);
+	}
+	return resources;
+}
+
+// Draws the resources of the next session, at least one if the rank has any.
+std::vector<int> draw_session(std::mt19937& gen, const std::vector<shared_resource>& resources, double subset) {
+	std::vector<int> ids;
+	std::bernoulli_distribution is_needed(subset);
+	for (const shared_resource& r : resources) {
+		if (is_needed(gen)) ids.push_back(r.id);
+	}
+	if (ids.empty() && !resources.empty()) {
+		ids.push_back(resources[rand_between(gen, 0, resources.size() - 1)].id);
+	}
+	return ids;
+}
+
+// Drives the lock until the deadline passes, sleeping while nothing arrives.
+void progress_until(resource_lock& lock, std::chrono::steady_clock::time_point deadline) {
+	lock.progress();
+	for (auto now{std::chrono::steady_clock::now()}; deadline > now; now = std::chrono::steady_clock::now()) {
+		if (!lock.progress()) {
+			std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, resource_lock::POLL_INTERVAL));
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	MPI_Init(nullptr, nullptr);
+
+	int size, id;
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	MPI_Comm_rank(MPI_COMM_WORLD, &id);
+
+	// Sessions are meals, drinking takes the eat duration
+	options opts;
+	opts.bench = true;
+	opts.think_min = opts.think_max = 0;
+	opts.meals = 1000;
+	topology_options topo;
+	try {
+		for (int i{1}; i < argc; ++i) {
+			const std::string arg{argv[i]};
+			const int remaining{argc - i - 1};
+			if (arg == "--topology" && remaining >= 1) {
+				topo.topology = argv[++i];
+			} else if (arg == "--degree" && remaining >= 1) {
+				topo.degree = std::atof(argv[++i]);
+			} else if (arg == "--subset" && remaining >= 1) {
+				topo.subset = std::atof(argv[++i]);
+			} else if (!parse_common_option(opts, argc, argv, i)) {
+				throw std::invalid_argument("unknown or incomplete option: " + arg);
+			}
+		}
+		check_options(opts);
+	} catch (const std::invalid_argument& e) {
+		if (id == 0) {
+			std::cerr << e.what() << std::endl;
+			std::cerr << argv[0] << " [--topology ring|random] [--degree <neighbors>] [--subset <probability>] "
+				<< common_usage() << std::endl;
+		}
+		MPI_Finalize();
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 gen{make_generator(opts, id)};
+	const std::vector<shared_resource> resources{build_graph(topo, opts.seed, id, size)};
+
+	long sessions{0};
+	latency_histogram acquisition;
+	double elapsed{0.0};
+	{
+		resource_lock lock(MPI_COMM_WORLD, resources);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		const auto start{std::chrono::steady_clock::now()};
+		auto end{std::chrono::steady_clock::time_point::max()};
+		if (opts.seconds > 0.0) {
+			end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(opts.seconds));
+		}
+		while ((opts.meals == 0 || sessions < opts.meals) && std::chrono::steady_clock::now() < end) {
+			progress_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(rand_between(gen, opts.think_min, opts.think_max)));
+
+			const auto thirsty_since{std::chrono::steady_clock::now()};
+			lock.acquire(draw_session(gen, resources, topo.subset));
+			lock.wait();
+			const std::chrono::duration<double, std::micro> thirsty{std::chrono::steady_clock::now() - thirsty_since};
+			acquisition.add(thirsty.count());
+			sessions++;
+
+			progress_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(rand_between(gen, opts.eat_min, opts.eat_max)));
+			lock.release();
+		}
+
+		// Finish the pending meal and sends, then keep serving the others until everyone is idle
+		while (!lock.is_idle()) {
+			if (!lock.progress()) {
+				std::this_thread::sleep_for(resource_lock::POLL_INTERVAL);
+			}
+		}
+		MPI_Request all_done;
+		MPI_Ibarrier(MPI_COMM_WORLD, &all_done);
+		int is_all_done{0};
+		while (!is_all_done) {
+			const bool is_busy{lock.progress()};
+			MPI_Test(&all_done, &is_all_done, MPI_STATUS_IGNORE);
+			if (!is_busy && !is_all_done) {
+				std::this_thread::sleep_for(resource_lock::POLL_INTERVAL);
+			}
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	long edges{static_cast<long>(resources.size())};
+	long total_edges{0};
+	MPI_Reduce(&edges, &total_edges, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	const summary s{reduce_summary(sessions, elapsed, 0.0, 0, acquisition, MPI_COMM_WORLD)};
+	if (id == 0) {
+		std::cout << "topology: " << topo.topology << " (" << total_edges / 2 << " shared resources)" << std::endl;
+		print_summary(std::cout, s, "sessions");
+	}
+
+	MPI_Finalize();
+	return EXIT_SUCCESS;
+}
@@ -4,23 +4,22 @@
 #include <thread>
 #include <chrono>
 #include <exception>
+#include <stdexcept>
+#include <memory>
+#include <algorithm>
 
 #include <mpi.h>
 
+#include "bench.hh"
+#include "bench_mpi.hh"
+#include "log.hh"
+
 // Global constants
 static constexpr int FORK_REQUEST{0};
 static constexpr int FORK_RESPONSE{1};
 static constexpr int LEFT{0};
 static constexpr int RIGHT{1};
 
-// Returns a random integer in the specified range.
-long rand_between(long min, long max) {
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<long> dist(min, max);
-	return dist(gen);
-}
-
 inline int fork_global_to_hand(int fork_id, int id, int size) {
 	if (fork_id == id) {
 		return LEFT;
@@ -58,95 +57,314 @@ inline void output_tabs(int count) {
 	for (int i{0}; i < count; ++i) std::cout << '\t';
 }
 
+// Fork state of one philosopher and the persistent receives that drive it.
+// Every message from a neighbor is matched by one of the pre-posted receives,
+// so both the think phase and the hungry phase react to it as soon as it arrives.
+struct philosopher {
+	int id;
+	int size;
+	bool has_fork[2]{false, true};
+	bool is_dirty[2]{true, true};
+	bool is_requested[2]{false, false};
+	// Our own request for the fork is on its way or waiting at the neighbor
+	bool is_outstanding[2]{false, false};
+	// Requests are deferred while eating, even for dirty forks
+	bool is_eating{false};
+	// Print every state change
+	bool verbose{true};
+
+	// One persistent receive per (hand, tag), indexed by 2 * hand + tag
+	MPI_Request receives[4];
+	int received_fork_id[4];
+
+	// Fork request to grant latency, measured by the requester
+	std::chrono::steady_clock::time_point requested_at[2];
+	double wait_total_ms{0.0};
+	long wait_count{0};
+	// Time from becoming hungry to eating
+	double hungry_total_ms{0.0};
+	long meals{0};
+	latency_histogram acquisition;
+
+	philosopher(int id, int size): id{id}, size{size} {
+		if (id == 0) has_fork[LEFT] = true;
+		if (id == size - 1) has_fork[RIGHT] = false;
+		for (const int hand : {LEFT, RIGHT}) {
+			for (const int tag : {FORK_REQUEST, FORK_RESPONSE}) {
+				const int index{2 * hand + tag};
+				MPI_Recv_init(&received_fork_id[index], 1, MPI_INT, neighbor_id(hand, id, size), tag, MPI_COMM_WORLD, &receives[index]);
+			}
+		}
+		MPI_Startall(4, receives);
+	}
+
+	void request_fork(int hand) {
+		const int fork_id{fork_hand_to_global(hand, id, size)};
+		requested_at[hand] = std::chrono::steady_clock::now();
+		is_outstanding[hand] = true;
+		MPI_Send(&fork_id, 1, MPI_INT, neighbor_id(hand, id, size), FORK_REQUEST, MPI_COMM_WORLD);
+		LOG_DEBUG("requesting fork %d", fork_id);
+	}
+
+	void give_fork(int hand) {
+		if (!has_fork[hand]) {
+			throw std::logic_error("giving away a fork that isn't held");
+		}
+		const int fork_id{fork_hand_to_global(hand, id, size)};
+		MPI_Send(&fork_id, 1, MPI_INT, neighbor_id(hand, id, size), FORK_RESPONSE, MPI_COMM_WORLD);
+		LOG_DEBUG("giving fork %d", fork_id);
+		has_fork[hand] = false;
+		is_requested[hand] = false;
+	}
+
+	// Processes the message received by the persistent receive at index and re-arms it.
+	void handle(int index) {
+		const int tag{index % 2};
+		const int hand{fork_global_to_hand(received_fork_id[index], id, size)};
+		if (tag == FORK_RESPONSE) {
+			has_fork[hand] = true;
+			is_dirty[hand] = false;
+			// A request handled before this response stays pending, see below
+			is_outstanding[hand] = false;
+			const std::chrono::duration<double, std::milli> waited{std::chrono::steady_clock::now() - requested_at[hand]};
+			wait_total_ms += waited.count();
+			wait_count++;
+			LOG_DEBUG("received fork %d after %.3f ms", received_fork_id[index], waited.count());
+		} else if (has_fork[hand] && is_dirty[hand] && !is_eating) {
+			// Give it away
+			give_fork(hand);
+		} else {
+			// Deny, but save the request. Without the fork, the neighbor has given it to us and
+			// asked for it again before our receive of the response completed; the response is
+			// still on its way and the request is answered once we have eaten with the fork.
+			is_requested[hand] = true;
+			LOG_TRACE("deferring request for fork %d", received_fork_id[index]);
+		}
+		MPI_Start(&receives[index]);
+	}
+
+	// Handles one message if there is one, without blocking.
+	bool poll() {
+		int index;
+		int has_msg{0};
+		MPI_Testany(4, receives, &index, &has_msg, MPI_STATUS_IGNORE);
+		if (!has_msg || index == MPI_UNDEFINED) return false;
+		handle(index);
+		return true;
+	}
+
+	// Blocks until a message arrives and handles it.
+	void wait() {
+		int index;
+		MPI_Waitany(4, receives, &index, MPI_STATUS_IGNORE);
+		handle(index);
+	}
+
+	// Serves requests until the deadline passes. MPI_Waitany has no timeout, so it polls
+	// and sleeps for up to POLL_INTERVAL between polls instead of keeping a core busy;
+	// that is also the longest a request waits for an answer.
+	static constexpr std::chrono::microseconds POLL_INTERVAL{250};
+	void idle_until(std::chrono::steady_clock::time_point deadline) {
+		// Drain pending messages even for zero durations, otherwise a philosopher
+		// that never thinks would keep eating and starve its neighbors
+		while (poll()) {}
+		for (auto now{std::chrono::steady_clock::now()}; deadline > now; now = std::chrono::steady_clock::now()) {
+			if (!poll()) {
+				std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, POLL_INTERVAL));
+			}
+		}
+	}
+
+	// Cancels and releases the persistent receives, once no more messages can arrive.
+	void stop_receives() {
+		for (MPI_Request& request : receives) {
+			MPI_Cancel(&request);
+			MPI_Wait(&request, MPI_STATUS_IGNORE);
+			MPI_Request_free(&request);
+		}
+	}
+
+	// Requests every missing fork that isn't already requested.
+	void request_missing() {
+		for (const int hand : {LEFT, RIGHT}) {
+			if (has_fork[hand] || is_outstanding[hand]) continue;
+			request_fork(hand);
+		}
+	}
+
+	double average_wait_ms() const {
+		return wait_count > 0 ? wait_total_ms / wait_count : 0.0;
+	}
+
+	double average_hungry_ms() const {
+		return meals > 0 ? hungry_total_ms / meals : 0.0;
+	}
+};
+
+// Bench-mode check that no two neighbors eat at once. Every rank exposes an eating flag
+// in an RMA window, raises it before eating and then reads the flags of its neighbors.
+// Both sides complete the write before the read, so of two overlapping meals at least
+// one sees the other.
+struct exclusion_check {
+	int id;
+	int size;
+	MPI_Win window;
+	int* eating;
+	long violations{0};
+
+	exclusion_check(int id, int size): id{id}, size{size} {
+		MPI_Win_allocate(sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &eating, &window);
+		*eating = 0;
+		MPI_Win_lock_all(0, window);
+		MPI_Win_sync(window);
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+
+	void set(int value) {
+		MPI_Accumulate(&value, 1, MPI_INT, id, 0, 1, MPI_INT, MPI_REPLACE, window);
+		MPI_Win_flush(id, window);
+	}
+
+	void start_meal() {
+		set(1);
+		if (size < 2) return;
+		for (const int hand : {LEFT, RIGHT}) {
+			int neighbor_eating{0};
+			const int neighbor{neighbor_id(hand, id, size)};
+			MPI_Fetch_and_op(nullptr, &neighbor_eating, MPI_INT, neighbor, 0, MPI_NO_OP, window);
+			MPI_Win_flush(neighbor, window);
+			if (neighbor_eating) {
+				violations++;
+				LOG_WARN("neighbor %d is eating at the same time", neighbor);
+			}
+		}
+	}
+
+	void end_meal() {
+		set(0);
+	}
+
+	// Collective, frees the window and returns the violations of all ranks on the root
+	long finish() {
+		MPI_Win_unlock_all(window);
+		MPI_Win_free(&window);
+		long total{0};
+		MPI_Reduce(&violations, &total, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+		return total;
+	}
+};
+
 int main(int argc, char* argv[]) {
-	MPI_Init(nullptr, nullptr);
+	// Only the main thread calls MPI, the log drainer doesn't
+	int provided;
+	MPI_Init_thread(nullptr, nullptr, MPI_THREAD_FUNNELED, &provided);
 
 	int size, id;
 	MPI_Comm_size(MPI_COMM_WORLD, &size);
 	MPI_Comm_rank(MPI_COMM_WORLD, &id);
+	logging::open("philosopher", id);
 
-	bool has_fork[]{false, true};
-	if (id == 0) has_fork[LEFT] = true;
-	if (id == size - 1) has_fork[RIGHT] = false;
-	bool is_dirty[]{true, true};
-	bool is_requested[]{false, false};
-	while (true) {
-		// Think
-		output_tabs(id); std::cout << "Thinking (" << id << ")" << std::endl;
-		const auto deadline{std::chrono::steady_clock::now() + std::chrono::milliseconds(rand_between(200, 3000))};
-		while (deadline > std::chrono::steady_clock::now()) {
-			// Check for messages
-			for (const int hand : {LEFT, RIGHT}) {
-				const int other{neighbor_id(hand, id, size)};
-				int has_msg{0};
-				MPI_Iprobe(other, FORK_REQUEST, MPI_COMM_WORLD, &has_msg, MPI_STATUS_IGNORE);
-				if (!has_msg) continue;
-				// There is a request, consume it
-				int fork_id;
-				MPI_Recv(&fork_id, 1, MPI_INT, other, FORK_REQUEST, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-				// Inform the receiver
-				MPI_Send(&fork_id, 1, MPI_INT, other, FORK_RESPONSE, MPI_COMM_WORLD);
-				// Update our forks
-				has_fork[fork_global_to_hand(fork_id, id, size)] = false;
-			}
-			// Sleep
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	options opts;
+	try {
+		opts = parse_options(argc, argv);
+	} catch (const std::invalid_argument& e) {
+		if (id == 0) {
+			std::cerr << e.what() << std::endl;
+			std::cerr << argv[0] << " " << common_usage() << std::endl;
 		}
+		logging::close();
+		MPI_Finalize();
+		return EXIT_FAILURE;
+	}
 
-		// Check if we have forks
-		while (!has_fork[LEFT] || !has_fork[RIGHT]) {
-			// Request a missing fork
-			int wanted_fork;
-			int wanted_fork_id;
-			if (!has_fork[LEFT]) {
-				wanted_fork_id = fork_hand_to_global(LEFT, id, size);
-				MPI_Send(&wanted_fork_id, 1, MPI_INT, neighbor_id(LEFT, id, size), FORK_REQUEST, MPI_COMM_WORLD);
-				wanted_fork = LEFT;
-				output_tabs(id); std::cout << "Requesting (" << wanted_fork_id << ")" << std::endl;
-			} else {
-				wanted_fork_id = fork_hand_to_global(RIGHT, id, size);
-				MPI_Send(&wanted_fork_id, 1, MPI_INT, neighbor_id(RIGHT, id, size), FORK_REQUEST, MPI_COMM_WORLD);
-				wanted_fork = RIGHT;
-				output_tabs(id); std::cout << "Requesting (" << wanted_fork_id << ")" << std::endl;
-			}
+	std::mt19937 gen{make_generator(opts, id)};
 
-			// Wait for messages
-			do {
-				MPI_Status status;
-				int fork_id;
-				MPI_Recv(&fork_id, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-				const int hand{fork_global_to_hand(fork_id, id, size)};
-				if (status.MPI_TAG == FORK_RESPONSE) {
-					has_fork[hand] = true;
-					is_dirty[hand] = false;
-					is_requested[hand] = false;
-				} else {
-					// This is a request for a fork
-					if (is_dirty[hand]) {
-						// Give it away
-						MPI_Send(&fork_id, 1, MPI_INT, status.MPI_SOURCE, FORK_RESPONSE, MPI_COMM_WORLD);
-						has_fork[hand] = false;
-						is_requested[hand] = false;
-					} else {
-						// Deny, but save the request
-						is_requested[hand] = true;
-					}
-				}
-			} while (!has_fork[wanted_fork]);
+	philosopher p(id, size);
+	p.verbose = !opts.bench;
+	std::unique_ptr<exclusion_check> exclusion;
+	if (opts.bench) {
+		exclusion = std::make_unique<exclusion_check>(id, size);
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	const auto start{std::chrono::steady_clock::now()};
+	auto end{std::chrono::steady_clock::time_point::max()};
+	if (opts.seconds > 0.0) {
+		end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(opts.seconds));
+	}
+	while ((opts.meals == 0 || p.meals < opts.meals) && std::chrono::steady_clock::now() < end) {
+		// Think
+		if (p.verbose) {
+			output_tabs(id); std::cout << "Thinking (" << id << ")" << std::endl;
+		}
+		// Serve requests as soon as they arrive, all our forks are dirty while thinking
+		p.idle_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(rand_between(gen, opts.think_min, opts.think_max)));
+
+		// Request both missing forks at once and wait for them together
+		const auto hungry_since{std::chrono::steady_clock::now()};
+		p.request_missing();
+		while (!p.has_fork[LEFT] || !p.has_fork[RIGHT]) {
+			p.wait();
+			// A dirty fork we had to give away is requested back right away. The neighbor can
+			// then see our request before our earlier response, handle() defers it.
+			p.request_missing();
 		}
+		const std::chrono::duration<double, std::milli> hungry{std::chrono::steady_clock::now() - hungry_since};
+		p.hungry_total_ms += hungry.count();
+		p.acquisition.add(hungry.count() * 1000.0);
+		p.meals++;
 
 		// Eat
-		is_dirty[LEFT] = is_dirty[RIGHT] = true;
-		output_tabs(id); std::cout << "Eating" << std::endl;
+		p.is_dirty[LEFT] = p.is_dirty[RIGHT] = true;
+		if (p.verbose) {
+			output_tabs(id); std::cout << "Eating (average fork wait " << p.average_wait_ms()
+				<< " ms, average time to eat " << p.average_hungry_ms() << " ms)" << std::endl;
+		}
+		p.is_eating = true;
+		if (exclusion) exclusion->start_meal();
+		p.idle_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(rand_between(gen, opts.eat_min, opts.eat_max)));
+		if (exclusion) exclusion->end_meal();
+		p.is_eating = false;
 
 		// Answer the requests
 		for (const int fork : {LEFT, RIGHT}) {
-			if (!is_requested[fork]) continue;
-			const int fork_id{fork_hand_to_global(fork, id, size)};
-			MPI_Send(&fork_id, 1, MPI_INT, neighbor_id(fork, id, size), FORK_RESPONSE, MPI_COMM_WORLD);
+			if (!p.is_requested[fork]) continue;
+			p.give_fork(fork);
+		}
+	}
+
+	// Keep giving forks away until every philosopher is done. Nobody is hungry
+	// once the barrier completes, so no fork messages are left in flight.
+	MPI_Request all_done;
+	MPI_Ibarrier(MPI_COMM_WORLD, &all_done);
+	int is_all_done{0};
+	while (!is_all_done) {
+		if (!p.poll()) {
+			std::this_thread::sleep_for(philosopher::POLL_INTERVAL);
+		}
+		// A fork that arrived clean after its request was deferred is never eaten with now
+		for (const int hand : {LEFT, RIGHT}) {
+			if (p.has_fork[hand] && p.is_requested[hand]) p.give_fork(hand);
+		}
+		MPI_Test(&all_done, &is_all_done, MPI_STATUS_IGNORE);
+	}
+	const double elapsed{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+	p.stop_receives();
+	LOG_INFO("done after %ld meals in %.3f s", p.meals, elapsed);
+
+	// Gather the metrics on the root
+	const summary s{reduce_summary(p.meals, elapsed, p.wait_total_ms, p.wait_count, p.acquisition, MPI_COMM_WORLD)};
+	if (id == 0) {
+		print_summary(std::cout, s);
+	}
+	if (exclusion) {
+		const long violations{exclusion->finish()};
+		if (id == 0) {
+			std::cout << "neighbors eating at once: " << violations << std::endl;
 		}
 	}
 
+	logging::close();
 	MPI_Finalize();
 	return EXIT_SUCCESS;
 }
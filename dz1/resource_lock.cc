@@ -0,0 +1,221 @@
+#include <vector>
+#include <map>
+#include <thread>
+#include <utility>
+#include <stdexcept>
+
+#include <mpi.h>
+
+#include "resource_lock.hh"
+
+// The lock uses its own communicator, so any tag works
+static constexpr int LOCK_TAG{0};
+
+resource_lock::resource_lock(MPI_Comm parent, const std::vector<shared_resource>& resources) {
+	MPI_Comm_dup(parent, &comm);
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	for (const shared_resource& r : resources) {
+		// Giving everything to the lower rank orders the forks acyclically
+		const bool is_holder{rank < r.neighbor};
+		edge_index[r.id] = edges.size();
+		edges.push_back(edge{r.id, r.neighbor, is_holder, true, false, false, is_holder, false, false, false});
+	}
+}
+
+resource_lock::~resource_lock() {
+	flush();
+	for (pending_send& s : sends) {
+		MPI_Wait(&s.request, MPI_STATUS_IGNORE);
+	}
+	MPI_Comm_free(&comm);
+}
+
+void resource_lock::acquire(const std::vector<int>& ids) {
+	if (drinking_state != drinking::TRANQUIL) {
+		throw std::logic_error("a session is already active");
+	}
+	for (const int id : ids) {
+		edges[edge_index.at(id)].is_needed = true;
+	}
+	drinking_state = drinking::THIRSTY;
+	if (dining_state == dining::THINKING) {
+		dining_state = dining::HUNGRY;
+	}
+	advance();
+	flush();
+}
+
+bool resource_lock::is_acquired() const {
+	return drinking_state == drinking::DRINKING;
+}
+
+void resource_lock::release() {
+	if (drinking_state != drinking::DRINKING) {
+		throw std::logic_error("no session to release");
+	}
+	for (edge& e : edges) {
+		e.is_needed = false;
+	}
+	drinking_state = drinking::TRANQUIL;
+	advance();
+	flush();
+}
+
+bool resource_lock::progress() {
+	bool is_handled{false};
+	while (true) {
+		int has_msg{0};
+		MPI_Message msg;
+		MPI_Status status;
+		MPI_Improbe(MPI_ANY_SOURCE, LOCK_TAG, comm, &has_msg, &msg, &status);
+		if (!has_msg) break;
+		int count;
+		MPI_Get_count(&status, MPI_INT, &count);
+		std::vector<int> records(count);
+		MPI_Mrecv(records.data(), count, MPI_INT, &msg, MPI_STATUS_IGNORE);
+		handle(records);
+		is_handled = true;
+	}
+	if (is_handled) {
+		advance();
+	}
+	const bool is_sent{!outgoing.empty()};
+	flush();
+	return is_handled || is_sent;
+}
+
+void resource_lock::wait() {
+	while (!is_acquired()) {
+		if (!progress()) {
+			std::this_thread::sleep_for(POLL_INTERVAL);
+		}
+	}
+}
+
+bool resource_lock::is_idle() const {
+	return drinking_state == drinking::TRANQUIL
+		&& dining_state == dining::THINKING
+		&& outgoing.empty()
+		&& sends.empty();
+}
+
+void resource_lock::send(edge& e, kind k) {
+	std::vector<int>& records{outgoing[e.neighbor]};
+	records.push_back(e.id);
+	records.push_back(k);
+}
+
+void resource_lock::handle(const std::vector<int>& records) {
+	for (std::size_t i{0}; i + 1 < records.size(); i += 2) {
+		edge& e{edges[edge_index.at(records[i])]};
+		switch (records[i + 1]) {
+		case FORK_REQUEST:
+			e.is_fork_requested = true;
+			break;
+		case FORK:
+			e.has_fork = true;
+			e.is_fork_dirty = false;
+			e.is_fork_outstanding = false;
+			break;
+		case BOTTLE_REQUEST:
+			e.is_bottle_requested = true;
+			break;
+		case BOTTLE:
+			e.has_bottle = true;
+			e.is_bottle_outstanding = false;
+			break;
+		default:
+			throw std::runtime_error("unknown lock message");
+		}
+	}
+}
+
+// A hungry philosopher keeps the clean forks it was given, an eating one keeps all of them.
+bool resource_lock::must_keep_fork(const edge& e) const {
+	return dining_state == dining::EATING
+		|| (dining_state == dining::HUNGRY && !e.is_fork_dirty);
+}
+
+// A needed bottle stays while drinking, or while thirsty and holding the fork of the same edge.
+bool resource_lock::must_keep_bottle(const edge& e) const {
+	if (!e.is_needed) return false;
+	return drinking_state == drinking::DRINKING
+		|| (drinking_state == drinking::THIRSTY && e.has_fork);
+}
+
+void resource_lock::advance() {
+	bool is_changed{true};
+	while (is_changed) {
+		is_changed = false;
+		if (dining_state == dining::HUNGRY) {
+			bool has_all{true};
+			for (const edge& e : edges) has_all = has_all && e.has_fork;
+			if (has_all) {
+				dining_state = dining::EATING;
+				is_changed = true;
+			}
+		}
+		if (drinking_state == drinking::THIRSTY) {
+			bool has_all{true};
+			for (const edge& e : edges) has_all = has_all && (!e.is_needed || e.has_bottle);
+			if (has_all) {
+				drinking_state = drinking::DRINKING;
+				is_changed = true;
+			}
+		}
+		if (dining_state == dining::EATING && drinking_state != drinking::THIRSTY) {
+			// The meal only existed to win the bottles
+			dining_state = dining::THINKING;
+			for (edge& e : edges) e.is_fork_dirty = true;
+			is_changed = true;
+		}
+	}
+
+	for (edge& e : edges) {
+		// Answer deferred requests that don't have to wait anymore
+		if (e.is_fork_requested && e.has_fork && !must_keep_fork(e)) {
+			send(e, FORK);
+			e.has_fork = false;
+			e.is_fork_requested = false;
+		}
+		if (e.is_bottle_requested && e.has_bottle && !must_keep_bottle(e)) {
+			send(e, BOTTLE);
+			e.has_bottle = false;
+			e.is_bottle_requested = false;
+		}
+		// Ask for what is missing, including what we just had to give away
+		if (dining_state == dining::HUNGRY && !e.has_fork && !e.is_fork_outstanding) {
+			send(e, FORK_REQUEST);
+			e.is_fork_outstanding = true;
+		}
+		if (drinking_state == drinking::THIRSTY && e.is_needed && !e.has_bottle && !e.is_bottle_outstanding) {
+			send(e, BOTTLE_REQUEST);
+			e.is_bottle_outstanding = true;
+		}
+	}
+}
+
+void resource_lock::flush() {
+	for (std::pair<const int, std::vector<int>>& batch : outgoing) {
+		sends.emplace_back();
+		pending_send& s{sends.back()};
+		s.records = std::move(batch.second);
+		MPI_Isend(s.records.data(), static_cast<int>(s.records.size()), MPI_INT, batch.first, LOCK_TAG, comm, &s.request);
+	}
+	outgoing.clear();
+
+	// Release the buffers of completed sends
+	for (std::size_t i{0}; i < sends.size();) {
+		int is_done{0};
+		MPI_Test(&sends[i].request, &is_done, MPI_STATUS_IGNORE);
+		if (is_done) {
+			if (i + 1 < sends.size()) {
+				sends[i] = std::move(sends.back());
+			}
+			sends.pop_back();
+		} else {
+			++i;
+		}
+	}
+}
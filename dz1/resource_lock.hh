@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <chrono>
+
+#include <mpi.h>
+
+// A resource shared by this rank and one neighbor, i.e. an edge of the conflict graph
+struct shared_resource {
+	// Global id, both ends of the edge use the same id
+	int id;
+	// The other rank that shares the resource
+	int neighbor;
+};
+
+// Distributed lock over arbitrary subsets of shared resources (the drinking philosophers
+// problem, Chandy and Misra 1984). Every edge of the conflict graph carries a bottle,
+// the resource itself, and a fork from the dining philosophers protocol of dz1.
+// The forks decide who keeps a contested bottle, so sessions can't deadlock or starve.
+//
+// The lock does not block: acquire() starts a session and progress(), called from the
+// caller's event loop, handles incoming messages and sends the outgoing ones. Everything
+// addressed to the same neighbor during one progress() call goes out as a single message.
+class resource_lock {
+public:
+	// Collective over comm. The lower rank of every edge initially holds its fork and bottle.
+	resource_lock(MPI_Comm comm, const std::vector<shared_resource>& resources);
+	~resource_lock();
+	resource_lock(const resource_lock&) = delete;
+	resource_lock& operator=(const resource_lock&) = delete;
+
+	// Starts a session that needs the resources with the given ids. Doesn't block.
+	void acquire(const std::vector<int>& ids);
+	// True while the session holds every resource it needs.
+	bool is_acquired() const;
+	// Ends the session and hands over the resources neighbors asked for.
+	void release();
+	// Handles incoming messages and sends the batched outgoing ones. Returns true if anything happened.
+	bool progress();
+	// Longest sleep between progress() calls that handled nothing, in wait() and in the
+	// callers' own loops, instead of keeping a core busy. A neighbor's request waits up to
+	// this long for an answer.
+	static constexpr std::chrono::microseconds POLL_INTERVAL{250};
+
+	// Calls progress() until the session is acquired.
+	void wait();
+	// True when this rank needs nothing and has nothing left to send. Once every rank of
+	// the communicator is idle, no lock messages are in flight.
+	bool is_idle() const;
+
+private:
+	enum class dining { THINKING, HUNGRY, EATING };
+	enum class drinking { TRANQUIL, THIRSTY, DRINKING };
+	// Kinds of records in a batch
+	enum kind : int { FORK_REQUEST, FORK, BOTTLE_REQUEST, BOTTLE };
+
+	struct edge {
+		int id;
+		int neighbor;
+		bool has_fork;
+		bool is_fork_dirty;
+		// The neighbor asked for the fork and we deferred it
+		bool is_fork_requested;
+		// We asked for the fork and haven't got it yet
+		bool is_fork_outstanding;
+		bool has_bottle;
+		bool is_bottle_requested;
+		bool is_bottle_outstanding;
+		// The bottle is part of the current session
+		bool is_needed;
+	};
+
+	struct pending_send {
+		MPI_Request request;
+		std::vector<int> records;
+	};
+
+	void send(edge& e, kind k);
+	void handle(const std::vector<int>& records);
+	bool must_keep_fork(const edge& e) const;
+	bool must_keep_bottle(const edge& e) const;
+	// Moves between states and answers deferred requests until nothing changes
+	void advance();
+	void flush();
+
+	MPI_Comm comm;
+	dining dining_state{dining::THINKING};
+	drinking drinking_state{drinking::TRANQUIL};
+	std::vector<edge> edges;
+	// Resource id to index into edges
+	std::map<int, std::size_t> edge_index;
+	// Records (resource id, kind) waiting to be sent, per neighbor
+	std::map<int, std::vector<int>> outgoing;
+	std::vector<pending_send> sends;
+};
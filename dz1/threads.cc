@@ -0,0 +1,248 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <string>
+
+#include "bench.hh"
+
+// Same philosopher and fork layout as the MPI version: philosopher id has fork id
+// on its left and fork id + 1 on its right, the forks start at the lower id.
+static constexpr int LEFT{0};
+static constexpr int RIGHT{1};
+static constexpr int MIN_PHILOSOPHERS{2};
+static constexpr int MAX_PHILOSOPHERS{128};
+
+// Bits of the fork state word, the owner id is stored above them
+static constexpr uint32_t DIRTY{1u << 0};
+// The philosopher that doesn't hold the fork wants it
+static constexpr uint32_t REQUESTED{1u << 1};
+// The owner is eating with it
+static constexpr uint32_t IN_USE{1u << 2};
+static constexpr int OWNER_SHIFT{8};
+
+inline uint32_t owner_of(uint32_t state) {
+	return state >> OWNER_SHIFT;
+}
+
+// A fork on its own cache line, so neighbors only contend for the forks they share.
+// All transitions of the Chandy-Misra protocol are single compare-and-swaps on the
+// state word: the owner never has to answer a request, the requester takes a dirty,
+// requested fork that isn't in use and it arrives clean.
+struct alignas(64) fork_slot {
+	std::atomic<uint32_t> state;
+};
+
+// Metrics of one philosopher, written only by its own thread
+struct alignas(64) philosopher_stats {
+	long meals{0};
+	double wait_total_ms{0.0};
+	long wait_count{0};
+	double elapsed{0.0};
+	latency_histogram acquisition;
+};
+
+inline void output_tabs(int count) {
+	for (int i{0}; i < count; ++i) std::cout << '\t';
+}
+
+class table {
+public:
+	table(int size): size{size}, forks{new fork_slot[size]} {
+		for (int fork{0}; fork < size; ++fork) {
+			// Fork 0 lies between the last and the first philosopher
+			const uint32_t owner{fork == 0 ? 0u : static_cast<uint32_t>(fork - 1)};
+			forks[fork].state.store(owner << OWNER_SHIFT | DIRTY, std::memory_order_relaxed);
+		}
+	}
+
+	std::atomic<uint32_t>& fork(int id, int hand) {
+		return forks[(id + hand) % size].state;
+	}
+
+	bool holds(int id, int hand) {
+		return owner_of(fork(id, hand).load(std::memory_order_acquire)) == static_cast<uint32_t>(id);
+	}
+
+	// Marks the fork as requested and takes it if the neighbor may not keep it.
+	bool try_take(int id, int hand) {
+		std::atomic<uint32_t>& f{fork(id, hand)};
+		uint32_t state{f.load(std::memory_order_acquire)};
+		while (owner_of(state) != static_cast<uint32_t>(id)) {
+			uint32_t next;
+			if ((state & DIRTY) && (state & REQUESTED) && !(state & IN_USE)) {
+				next = static_cast<uint32_t>(id) << OWNER_SHIFT;
+			} else if (!(state & REQUESTED)) {
+				next = state | REQUESTED;
+			} else {
+				return false;
+			}
+			if (f.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				if (owner_of(next) == static_cast<uint32_t>(id)) return true;
+				state = next;
+			}
+		}
+		return true;
+	}
+
+	// Starts using a held fork. Eating dirties it. A requested clean fork is used once more,
+	// a requested dirty one is owed to the neighbor and must go to it before we eat again.
+	// Returns false if the fork has been taken or is owed, otherwise sets was_dirty.
+	bool try_use(int id, int hand, bool& was_dirty) {
+		std::atomic<uint32_t>& f{fork(id, hand)};
+		uint32_t state{f.load(std::memory_order_acquire)};
+		while (owner_of(state) == static_cast<uint32_t>(id)) {
+			if ((state & (DIRTY | REQUESTED)) == (DIRTY | REQUESTED)) return false;
+			if (f.compare_exchange_weak(state, state | DIRTY | IN_USE, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				was_dirty = state & DIRTY;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Undoes try_use when the other fork couldn't be used, a clean fork stays clean.
+	void put_back(int id, int hand, bool was_dirty) {
+		fork(id, hand).fetch_and(~(IN_USE | (was_dirty ? 0u : DIRTY)), std::memory_order_release);
+	}
+
+	// Stops using the fork, the neighbor can take it from now on if it asked.
+	void put_down(int id, int hand) {
+		fork(id, hand).fetch_and(~IN_USE, std::memory_order_release);
+	}
+
+private:
+	int size;
+	std::unique_ptr<fork_slot[]> forks;
+};
+
+void philosopher(int id, const options& opts, table& t, const std::atomic<bool>& go,
+		std::chrono::steady_clock::time_point& start, std::mutex& output, philosopher_stats& stats) {
+	std::mt19937 gen{make_generator(opts, id)};
+	const bool verbose{!opts.bench};
+	while (!go.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+
+	auto end{std::chrono::steady_clock::time_point::max()};
+	if (opts.seconds > 0.0) {
+		end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(opts.seconds));
+	}
+	while ((opts.meals == 0 || stats.meals < opts.meals) && std::chrono::steady_clock::now() < end) {
+		// Think, the neighbors take our dirty forks without us
+		if (verbose) {
+			std::lock_guard<std::mutex> lock(output);
+			output_tabs(id); std::cout << "Thinking (" << id << ")" << std::endl;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(rand_between(gen, opts.think_min, opts.think_max)));
+
+		// Get hungry, take both forks and mark them as used together
+		const auto hungry_since{std::chrono::steady_clock::now()};
+		std::chrono::steady_clock::time_point requested_at[2];
+		bool is_waiting[2]{false, false};
+		while (true) {
+			bool has_both{true};
+			for (const int hand : {LEFT, RIGHT}) {
+				if (t.holds(id, hand)) continue;
+				if (!is_waiting[hand]) {
+					requested_at[hand] = std::chrono::steady_clock::now();
+					is_waiting[hand] = true;
+				}
+				if (t.try_take(id, hand)) {
+					const std::chrono::duration<double, std::milli> waited{std::chrono::steady_clock::now() - requested_at[hand]};
+					stats.wait_total_ms += waited.count();
+					stats.wait_count++;
+					is_waiting[hand] = false;
+				} else {
+					has_both = false;
+				}
+			}
+			bool was_dirty[2];
+			if (has_both && t.try_use(id, LEFT, was_dirty[LEFT])) {
+				if (t.try_use(id, RIGHT, was_dirty[RIGHT])) break;
+				// The right fork got taken in the meantime or is owed to the neighbor
+				t.put_back(id, LEFT, was_dirty[LEFT]);
+			}
+			std::this_thread::yield();
+		}
+		const std::chrono::duration<double, std::micro> hungry{std::chrono::steady_clock::now() - hungry_since};
+		stats.acquisition.add(hungry.count());
+		stats.meals++;
+
+		// Eat
+		if (verbose) {
+			std::lock_guard<std::mutex> lock(output);
+			output_tabs(id); std::cout << "Eating (" << id << ")" << std::endl;
+		}
+		const long eat_ms{rand_between(gen, opts.eat_min, opts.eat_max)};
+		if (eat_ms > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(eat_ms));
+		}
+		t.put_down(id, LEFT);
+		t.put_down(id, RIGHT);
+	}
+	stats.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	options opts;
+	int size{5};
+	try {
+		for (int i{1}; i < argc; ++i) {
+			const std::string arg{argv[i]};
+			if (arg == "--philosophers" && i + 1 < argc) {
+				size = std::atoi(argv[++i]);
+			} else if (!parse_common_option(opts, argc, argv, i)) {
+				throw std::invalid_argument("unknown or incomplete option: " + arg);
+			}
+		}
+		check_options(opts);
+		if (size < MIN_PHILOSOPHERS || size > MAX_PHILOSOPHERS) {
+			throw std::invalid_argument("the number of philosophers must be between 2 and 128");
+		}
+	} catch (const std::invalid_argument& e) {
+		std::cerr << e.what() << std::endl;
+		std::cerr << argv[0] << " [--philosophers <count>] " << common_usage() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	table t(size);
+	std::vector<philosopher_stats> stats(size);
+	std::atomic<bool> go{false};
+	std::mutex output;
+	std::chrono::steady_clock::time_point start;
+	std::vector<std::thread> threads;
+	for (int id{0}; id < size; ++id) {
+		threads.emplace_back(philosopher, id, std::cref(opts), std::ref(t), std::cref(go),
+			std::ref(start), std::ref(output), std::ref(stats[id]));
+	}
+	start = std::chrono::steady_clock::now();
+	go.store(true, std::memory_order_release);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	summary s;
+	s.philosophers = size;
+	s.min_meals = stats[0].meals;
+	s.max_meals = stats[0].meals;
+	for (const philosopher_stats& p : stats) {
+		s.elapsed = std::max(s.elapsed, p.elapsed);
+		s.meals += p.meals;
+		s.min_meals = std::min(s.min_meals, p.meals);
+		s.max_meals = std::max(s.max_meals, p.meals);
+		s.wait_total_ms += p.wait_total_ms;
+		s.wait_count += p.wait_count;
+		s.acquisition.merge(p.acquisition);
+	}
+	print_summary(std::cout, s);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <string>
+
+#include "connect4.hh"
+
+// Every microbenchmark repeats its body until it has run for at least this long
+static constexpr std::chrono::milliseconds MIN_BENCH_TIME{200};
+
+struct result {
+	std::string position;
+	std::string name;
+	// Mean time of one repetition
+	double ns;
+	// Root utility, only set by the search benchmarks
+	double utility;
+	// Fields checked, moves generated, bytes of a task or nodes of the search tree
+	std::size_t count;
+};
+
+// Runs body until MIN_BENCH_TIME passes and returns the mean time of one call in nanoseconds.
+template <typename F>
+double time_ns(F body) {
+	const auto start{std::chrono::steady_clock::now()};
+	auto now{start};
+	std::size_t reps{0};
+	while (now - start < MIN_BENCH_TIME) {
+		body();
+		reps++;
+		now = std::chrono::steady_clock::now();
+	}
+	return std::chrono::duration<double, std::nano>(now - start).count() / reps;
+}
+
+std::string position_name(const std::string& filename) {
+	const std::size_t slash{filename.find_last_of("/\\")};
+	std::string name{slash == std::string::npos ? filename : filename.substr(slash + 1)};
+	const std::size_t dot{name.find_last_of('.')};
+	return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+void bench_position(const std::string& filename, uint8_t max_depth, std::vector<result>& results) {
+	const std::string name{position_name(filename)};
+	state initial{read_state(filename)};
+	initial.last_move_player = HUMAN;
+	board& b{initial.b};
+
+	// Win detection over every occupied field
+	std::size_t wins{0};
+	std::size_t fields{0};
+	for (uint8_t col{0}; col < b.width; ++col) {
+		for (uint8_t row{0}; row < b.height; ++row) {
+			if (b(col, row) != EMPTY) fields++;
+		}
+	}
+	const double connect4_ns{time_ns([&]() {
+		for (uint8_t col{0}; col < b.width; ++col) {
+			for (uint8_t row{0}; row < b.height; ++row) {
+				if (b(col, row) == EMPTY) continue;
+				wins += b.check_connect4(col, row);
+			}
+		}
+	})};
+	results.push_back(result{name, "check_connect4", fields > 0 ? connect4_ns / fields : 0.0, 0.0, fields});
+	if (wins > 0) {
+		std::cerr << name << " already contains a connect 4" << std::endl;
+	}
+
+	// All legal child states, as generated by the search
+	initial.remaining_depth = 1;
+	std::size_t moves{0};
+	const double moves_ns{time_ns([&]() {
+		moves = 0;
+		for (uint8_t col{0}; col < b.width; ++col) {
+			uint8_t h{0};
+			while (h < b.height && b(col, h) != EMPTY) h++;
+			if (h == b.height) continue;
+			state child{child_state(initial, col, h)};
+			moves++;
+		}
+	})};
+	results.push_back(result{name, "move_generation", moves_ns, 0.0, moves});
+
+	// Serialization round trip of a task
+	std::vector<std::byte> bytes;
+	const double serialize_ns{time_ns([&]() {
+		bytes.clear();
+		initial.serialize(bytes);
+		state other;
+		other.deserialize(bytes);
+	})};
+	results.push_back(result{name, "serialize_deserialize", serialize_ns, 0.0, bytes.size()});
+
+	// Sequential search at fixed depths
+	for (const char* eval_name : {"zero", "threats"}) {
+		const evaluator eval{select_evaluator(eval_name)};
+		for (uint8_t depth{1}; depth <= max_depth; ++depth) {
+			std::shared_ptr<node> root;
+			double utility{0.0};
+			const double search_ns{time_ns([&]() {
+				state s{initial};
+				s.remaining_depth = depth;
+				root = std::make_shared<node>(s);
+				utility = compute_utility(root, eval);
+			})};
+			results.push_back(result{
+				name,
+				"compute_utility/" + std::string{eval_name} + "/" + std::to_string(depth),
+				search_ns,
+				utility,
+				count_nodes(root)
+			});
+		}
+	}
+}
+
+void write_json(const std::string& filename, const std::vector<result>& results) {
+	std::ofstream file(filename);
+	file << std::setprecision(17);
+	file << "[\n";
+	for (std::size_t i{0}; i < results.size(); ++i) {
+		const result& r{results[i]};
+		file << "\t{\"position\": \"" << r.position << "\", \"name\": \"" << r.name << "\", "
+			<< "\"ns\": " << r.ns << ", \"utility\": " << r.utility << ", \"count\": " << r.count << "}";
+		file << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	file << "]\n";
+}
+
+void write_markdown(std::ostream& out, const std::vector<result>& results) {
+	out << "| Position | Benchmark | Time (ns) | Utility | Count |\n";
+	out << "| ---      | ---       | ---:      | ---:    | ---:  |\n";
+	for (const result& r : results) {
+		out << "| " << r.position << " | " << r.name << " | " << std::fixed << std::setprecision(1) << r.ns
+			<< " | " << std::setprecision(6) << r.utility << " | " << r.count << " |\n";
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 4) {
+		std::cerr << argv[0] << " <max_depth> <report.json> <board> [<board> ...]" << std::endl;
+		return -1;
+	}
+	const uint8_t max_depth{static_cast<uint8_t>(atoi(argv[1]))};
+	const std::string report{argv[2]};
+
+	std::vector<result> results;
+	for (int i{3}; i < argc; ++i) {
+		bench_position(argv[i], max_depth, results);
+	}
+
+	write_json(report, results);
+	write_markdown(std::cout, results);
+
+	return 0;
+}
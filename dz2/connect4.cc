@@ -0,0 +1,232 @@
+#include "connect4.hh"
+
+#include <cmath>
+#include <stdexcept>
+#include <fstream>
+
+// The original behaviour: positions at the depth limit are treated as draws
+double evaluate_zero(const state&) {
+	return 0.0;
+}
+
+// Maps the incrementally maintained threat score into (-THREAT_BOUND, THREAT_BOUND)
+double evaluate_threats(const state& s) {
+	const double score{static_cast<double>(s.threat)};
+	return THREAT_BOUND * score / (std::abs(score) + THREAT_SCALE);
+}
+
+evaluator select_evaluator(const std::string& name) {
+	if (name == "zero") {
+		return evaluate_zero;
+	} else if (name == "threats") {
+		return evaluate_threats;
+	}
+	throw std::invalid_argument("unknown evaluator: " + name);
+}
+
+std::size_t count_nodes(std::shared_ptr<node> root) {
+	std::size_t subtree{1};
+	for (std::shared_ptr<node> subnode : root->children) {
+		subtree += count_nodes(subnode);
+	}
+	return subtree;
+}
+
+pair select_best_move(std::shared_ptr<node> root) {
+	double best_utility{-1.0};
+	pair best_move;
+	for (std::shared_ptr<node> subnode : root->children) {
+		if (subnode->s.utility >= best_utility) {
+			best_utility = subnode->s.utility;
+			uint8_t h{0};
+			while (h < subnode->s.b.height && subnode->s.b(subnode->s.last_move_col, h) != EMPTY) {
+				h++;
+			}
+			h--;
+			best_move = pair(subnode->s.last_move_col, h);
+		}
+	}
+	return best_move;
+}
+
+void complete_computation(std::shared_ptr<node> root) {
+	if (root->s.utility != 0.0) {
+		return;
+	}
+	double utility{0.0};
+	double size{static_cast<double>(root->children.size())};
+	for (std::shared_ptr<node> subnode : root->children) {
+		complete_computation(subnode);
+		utility += subnode->s.utility / size;
+	}
+	root->s.utility = utility;
+}
+
+double compute_utility(std::shared_ptr<node> root, evaluator eval) {
+	if (root->s.remaining_depth <= 0) {
+		return eval(root->s);
+	}
+	// Generate subnodes
+	for (uint8_t col{0}; col < root->s.b.width; ++col) {
+		// Compute the next valid move
+		uint8_t h{0};
+		while (
+			h < root->s.b.height
+			&& root->s.b(col, h) != EMPTY
+		) h++;
+		if (h == root->s.b.height) {
+			// The column is full, skip the column.
+			continue;
+		}
+
+		// Compute the state
+		state new_state{child_state(root->s, col, h)};
+		const uint8_t next_player{new_state.last_move_player};
+
+		// Check if there's connect 4
+		if (new_state.b.check_connect4(col, h)) {
+			if (next_player == COMPUTER) {
+				new_state.utility = 1.0;
+				// The computer always selects a move (subnode) that wins the game.
+				root->s.utility = 1.0;
+			} else {
+				new_state.utility = -1.0;
+				// Human can make a mistake
+			}
+		}
+
+		std::shared_ptr<node> new_node{std::make_shared<node>(new_state)};
+		if (new_state.utility == 1.0) {
+			// No need to consider other moves (subnodes).
+			// Root now has the computed utility.
+			root->children.clear();
+			root->children.push_back(new_node);
+			return 1.0;
+		}
+
+		root->children.push_back(new_node);
+		if (new_state.utility == -1.0) {
+			// Don't consider subnodes if a human won.
+			continue;
+		}
+
+		new_node->s.utility = compute_utility(new_node, eval);
+	}
+
+	double utility{0.0};
+	double size{static_cast<double>(root->children.size())};
+	for (std::shared_ptr<node> subnode : root->children) {
+		utility += subnode->s.utility / size;
+	}
+	return utility;
+}
+
+state child_state(state& parent, uint8_t col, uint8_t row) {
+	// Compute the player
+	uint8_t next_player{COMPUTER};
+	if (parent.last_move_player == COMPUTER) {
+		next_player = HUMAN;
+	}
+
+	// Compute the board
+	board new_board{parent.b.copy()};
+	new_board(col, row) = next_player;
+
+	// Compute the state
+	state new_state(
+		new_board,
+		parent.remaining_depth - 1,
+		col,
+		next_player
+	);
+	new_state.threat = parent.threat + new_board.threat_delta(col, row);
+	return new_state;
+}
+
+std::vector<std::shared_ptr<node>> generate_tasks(std::shared_ptr<node> root_node) {
+	std::vector<std::shared_ptr<node>> tasks;
+	generate_tasks_rec(tasks, root_node);
+	return tasks;
+}
+
+void generate_tasks_rec(std::vector<std::shared_ptr<node>>& tasks, std::shared_ptr<node> root) {
+	if (root->children.empty() && root->s.utility == 0.0) {
+		tasks.push_back(root);
+		return;
+	}
+	for (std::shared_ptr<node> subnode : root->children) {
+		generate_tasks_rec(tasks, subnode);
+	}
+}
+
+// Expects a starting state that is not a win.
+void build_sched_tree(std::shared_ptr<node> root, uint8_t sched_tree_depth, uint8_t max_depth) {
+	const uint8_t depth{static_cast<uint8_t>(max_depth - root->s.remaining_depth)};
+	if (depth >= sched_tree_depth) {
+		return;
+	}
+	// Generate subnodes
+	for (uint8_t col{0}; col < root->s.b.width; ++col) {
+		// Compute the next valid move
+		uint8_t h{0};
+		while (
+			h < root->s.b.height
+			&& root->s.b(col, h) != EMPTY
+		) h++;
+		if (h == root->s.b.height) {
+			// The column is full, skip the column.
+			continue;
+		}
+
+		// Compute the state
+		state new_state{child_state(root->s, col, h)};
+		const uint8_t next_player{new_state.last_move_player};
+
+		// Check if there's connect 4
+		if (new_state.b.check_connect4(col, h)) {
+			if (next_player == COMPUTER) {
+				new_state.utility = 1.0;
+				// The computer always selects a move (subnode) that wins the game.
+				root->s.utility = 1.0;
+			} else {
+				new_state.utility = -1.0;
+				// Human can make a mistake
+			}
+		}
+
+		std::shared_ptr<node> new_node{std::make_shared<node>(new_state)};
+		if (new_state.utility == 1.0) {
+			// No need to consider other moves (subnodes). The computer always makes the move that wins the game.
+			root->children.clear();
+			root->children.push_back(new_node);
+			return;
+		}
+
+		root->children.push_back(new_node);
+		if (new_state.utility == -1.0) {
+			// Don't consider subnodes if a human won.
+			continue;
+		}
+		build_sched_tree(new_node, sched_tree_depth, max_depth);
+	}
+}
+
+state read_state(const std::string filename) {
+	std::ifstream file(filename);
+
+	int width, height;
+
+	file >> height >> width;
+	board b(width, height);
+	for (int j{0}; j < height; ++j) {
+		for (int i{0}; i < width; ++i) {
+			int field;
+			file >> field;
+			b(i, height - 1 - j) = static_cast<uint8_t>(field);
+		}
+	}
+
+	state s(b, 0, 0, HUMAN);
+	s.threat = b.threat_score();
+	return s;
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <initializer_list>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+constexpr uint8_t EMPTY{0};
+constexpr uint8_t COMPUTER{1};
+constexpr uint8_t HUMAN{2};
+
+// Heuristic weights of open windows (four cells in a row with no opposing pieces)
+constexpr int16_t OPEN_THREE_WEIGHT{8};
+constexpr int16_t OPEN_TWO_WEIGHT{1};
+// Controls how fast the heuristic utility approaches its bound
+constexpr double THREAT_SCALE{16.0};
+// Heuristic utilities stay inside (-THREAT_BOUND, THREAT_BOUND) so they never look like a decided game
+constexpr double THREAT_BOUND{0.5};
+
+struct pair {
+	int8_t x, y;
+	
+	pair(int8_t a, int8_t b): x{a}, y{b} {};
+	pair(): x{0}, y{0} {};
+	pair(std::initializer_list<int8_t> l) {
+		auto iter{l.begin()};
+		x = *iter++;
+		y = *iter;
+	};
+	pair operator*(int8_t m) const { return pair(x * m, y * m); };
+	pair operator+(int8_t a) const { return pair(x + a, y + a); };
+	pair operator-(int8_t a) const { return pair(x - a, y - a); };
+	pair operator+(const pair& other) const { return pair(x + other.x, y + other.y); };
+	pair operator-(const pair& other) const { return pair(x - other.x, y - other.y); };
+};
+
+struct board {
+	uint8_t width;
+	uint8_t height;
+	std::shared_ptr<uint8_t[]> mem;
+
+	board():
+		width{0}, height{0}, mem{nullptr} {};
+	board(uint8_t w, uint8_t h):
+		width{w}, height{h}, mem{new uint8_t[w * h]} {
+		for (std::size_t i{0}; i < w * h; ++i) {
+			mem[i] = EMPTY;
+		}
+	};
+	uint8_t& operator()(uint8_t col, uint8_t row) {
+		return mem[row + col * height];
+	};
+	uint8_t& operator()(pair loc) {
+		return mem[loc.y + loc.x * height];
+	};
+	board copy() {
+		board other;
+		other.width = width;
+		other.height = height;
+		other.mem = std::shared_ptr<uint8_t[]>(new uint8_t[width * height]);
+		for (std::size_t i{0}; i < width * height; ++i) {
+			other.mem[i] = mem[i];
+		}
+		return other;
+	};
+	bool check_connect4(uint8_t col, uint8_t row) {
+		const std::array<pair, 4> directions{pair{0, 1}, pair{1, 1}, pair{1, 0}, pair{1, -1}};
+		const uint8_t player{operator()(col, row)};
+		const pair pos{static_cast<int8_t>(col), static_cast<int8_t>(row)};
+		for (pair dir : directions) {
+			for (int8_t offset{0}; offset < 4; ++offset) {
+				pair start{pos - dir * offset};
+				if (start.x < 0 || start.x >= width || start.y < 0 || start.y >= height) {
+					// Outside of the board
+					continue;
+				}
+				bool check{true};
+				for (int8_t i{0}; i < 4; ++i) {
+					const pair elem{start + dir * i};
+					if (elem.x < 0 || elem.x >= width || elem.y < 0 || elem.y >= height) {
+						check = false;
+						break;
+					}
+					check = check && (operator()(elem) == player);
+				}
+				if (check) {
+					return true;
+				}
+			}
+		}
+		return false;
+	};
+	// Value of the open window starting at start in the direction dir, from the computer's perspective.
+	// Windows that leave the board or contain pieces of both players are worth nothing.
+	int16_t window_value(pair start, pair dir) {
+		const pair end{start + dir * 3};
+		if (start.x < 0 || start.x >= width || start.y < 0 || start.y >= height) {
+			return 0;
+		}
+		if (end.x < 0 || end.x >= width || end.y < 0 || end.y >= height) {
+			return 0;
+		}
+		int8_t computer{0};
+		int8_t human{0};
+		for (int8_t i{0}; i < 4; ++i) {
+			const uint8_t field{operator()(start + dir * i)};
+			if (field == COMPUTER) {
+				computer++;
+			} else if (field == HUMAN) {
+				human++;
+			}
+		}
+		if (computer > 0 && human > 0) {
+			return 0;
+		}
+		const int8_t count{computer > 0 ? computer : human};
+		int16_t value{0};
+		if (count == 3) {
+			value = OPEN_THREE_WEIGHT;
+		} else if (count == 2) {
+			value = OPEN_TWO_WEIGHT;
+		}
+		return computer > 0 ? value : -value;
+	};
+	// Sum of the values of all windows passing through the field (col, row)
+	int16_t windows_through(uint8_t col, uint8_t row) {
+		const std::array<pair, 4> directions{pair{0, 1}, pair{1, 1}, pair{1, 0}, pair{1, -1}};
+		const pair pos{static_cast<int8_t>(col), static_cast<int8_t>(row)};
+		int16_t sum{0};
+		for (pair dir : directions) {
+			for (int8_t offset{0}; offset < 4; ++offset) {
+				sum += window_value(pos - dir * offset, dir);
+			}
+		}
+		return sum;
+	};
+	// Change of the threat score caused by the piece that was just placed on (col, row).
+	// Only the windows through the new piece change, so the score can be maintained incrementally.
+	int16_t threat_delta(uint8_t col, uint8_t row) {
+		const uint8_t player{operator()(col, row)};
+		const int16_t after{windows_through(col, row)};
+		operator()(col, row) = EMPTY;
+		const int16_t before{windows_through(col, row)};
+		operator()(col, row) = player;
+		return after - before;
+	};
+	// Full evaluation of open three-in-a-rows and two-in-a-rows, from the computer's perspective
+	int16_t threat_score() {
+		const std::array<pair, 4> directions{pair{0, 1}, pair{1, 1}, pair{1, 0}, pair{1, -1}};
+		int16_t score{0};
+		for (int8_t x{0}; x < width; ++x) {
+			for (int8_t y{0}; y < height; ++y) {
+				for (pair dir : directions) {
+					score += window_value(pair{x, y}, dir);
+				}
+			}
+		}
+		return score;
+	};
+	// Accepts possibly empty array and expands it
+	void serialize(std::vector<std::byte>& arr) {
+		const std::size_t size{(2 + width * height) * sizeof(uint8_t)};
+		const std::size_t old_size{arr.size()};
+		arr.resize(old_size + size, std::byte{0});
+		uint8_t* ints{reinterpret_cast<uint8_t*>(arr.data() + old_size)};
+		*ints++ = width;
+		*ints++ = height;
+		std::memcpy(ints, mem.get(), width * height);
+	};
+	std::size_t deserialize(const std::vector<std::byte>& arr) {
+		const uint8_t* ints{reinterpret_cast<const uint8_t*>(arr.data())};
+		width = *ints++;
+		height = *ints++;
+		mem = std::shared_ptr<uint8_t[]>(new uint8_t[width * height]);
+		std::memcpy(mem.get(), ints, width * height);
+		return (2 + width * height) * sizeof(uint8_t);
+	};
+};
+
+struct state {
+	board b;
+	uint8_t remaining_depth;
+	// Column: 0 .. WIDTH-1
+	uint8_t last_move_col;
+	// Computer or human move
+	uint8_t last_move_player;
+	double utility;
+	// Threat score of the board, maintained incrementally from the parent state
+	int16_t threat;
+
+	state() = default;
+	state(board b, uint8_t rem_d, uint8_t col, uint8_t player):
+		b{b},
+		remaining_depth{rem_d},
+		last_move_col{col},
+		last_move_player{player},
+		utility{0.0},
+		threat{0} {};
+	state(uint8_t w, uint8_t h, uint8_t rem_d, uint8_t col, uint8_t player):
+		b(w, h),
+		remaining_depth{rem_d},
+		last_move_col{col},
+		last_move_player{player},
+		utility{0.0},
+		threat{0} {};
+	// Accepts possibly empty array and expands it
+	void serialize(std::vector<std::byte>& arr) {
+		b.serialize(arr);
+		const std::size_t size{3*sizeof(uint8_t) + sizeof(double) + sizeof(int16_t)};
+		const std::size_t old_size{arr.size()};
+		arr.resize(old_size + size, std::byte{0});
+		uint8_t* ints{reinterpret_cast<uint8_t*>(arr.data() + old_size)};
+		*ints++ = remaining_depth;
+		*ints++ = last_move_col;
+		*ints++ = last_move_player;
+		double* doubles{reinterpret_cast<double*>(ints)};
+		*doubles++ = utility;
+		int16_t* shorts{reinterpret_cast<int16_t*>(doubles)};
+		*shorts = threat;
+	};
+	std::size_t deserialize(const std::vector<std::byte>& arr) {
+		const std::size_t used{b.deserialize(arr)};
+		const uint8_t* ints{reinterpret_cast<const uint8_t*>(arr.data() + used)};
+		remaining_depth = *ints++;
+		last_move_col = *ints++;
+		last_move_player = *ints++;
+		const double* doubles{reinterpret_cast<const double*>(ints)};
+		utility = *doubles++;
+		const int16_t* shorts{reinterpret_cast<const int16_t*>(doubles)};
+		threat = *shorts;
+		return used + 3 * sizeof(uint8_t) + sizeof(double) + sizeof(int16_t);
+	};
+};
+
+// Static evaluation of a state at the depth limit
+using evaluator = double (*)(const state&);
+
+// The original behaviour: positions at the depth limit are treated as draws
+double evaluate_zero(const state& s);
+// Maps the incrementally maintained threat score into (-THREAT_BOUND, THREAT_BOUND)
+double evaluate_threats(const state& s);
+evaluator select_evaluator(const std::string& name);
+
+struct node {
+	state s;
+	std::vector<std::shared_ptr<node>> children;
+
+	node(state s): s{s} {};
+	node() = default;
+};
+
+state read_state(const std::string filename);
+// Builds the state after the next player drops a piece into the column col, landing on row.
+state child_state(state& parent, uint8_t col, uint8_t row);
+// Expects a starting state that is not a win.
+void build_sched_tree(std::shared_ptr<node> root, uint8_t sched_tree_depth, uint8_t max_depth);
+void generate_tasks_rec(std::vector<std::shared_ptr<node>>& tasks, std::shared_ptr<node> root);
+std::vector<std::shared_ptr<node>> generate_tasks(std::shared_ptr<node> root_node);
+double compute_utility(std::shared_ptr<node> root, evaluator eval);
+void complete_computation(std::shared_ptr<node> root);
+pair select_best_move(std::shared_ptr<node> root);
+std::size_t count_nodes(std::shared_ptr<node> root);
@@ -5,199 +5,45 @@
 #include <iostream>
 #include <cmath>
 #include <cstdint>
-#include <initializer_list>
-#include <array>
 #include <stdexcept>
 #include <cstddef>
-#include <cstring>
 #include <string>
-#include <fstream>
 
-constexpr uint8_t EMPTY{0};
-constexpr uint8_t COMPUTER{1};
-constexpr uint8_t HUMAN{2};
+#include "connect4.hh"
+#include "log.hh"
 
 constexpr uint8_t TASK_TAG{0};
 constexpr uint8_t END_TAG{1};
 constexpr uint8_t UTILITY_TAG{2};
 
-struct pair {
-	int8_t x, y;
-	
-	pair(int8_t a, int8_t b): x{a}, y{b} {};
-	pair(): x{0}, y{0} {};
-	pair(std::initializer_list<int8_t> l) {
-		auto iter{l.begin()};
-		x = *iter++;
-		y = *iter;
-	};
-	pair operator*(int8_t m) const { return pair(x * m, y * m); };
-	pair operator+(int8_t a) const { return pair(x + a, y + a); };
-	pair operator-(int8_t a) const { return pair(x - a, y - a); };
-	pair operator+(const pair& other) const { return pair(x + other.x, y + other.y); };
-	pair operator-(const pair& other) const { return pair(x - other.x, y - other.y); };
-};
-
-struct board {
-	uint8_t width;
-	uint8_t height;
-	std::shared_ptr<uint8_t[]> mem;
-
-	board():
-		width{0}, height{0}, mem{nullptr} {};
-	board(uint8_t w, uint8_t h):
-		width{w}, height{h}, mem{new uint8_t[w * h]} {
-		for (std::size_t i{0}; i < w * h; ++i) {
-			mem[i] = EMPTY;
-		}
-	};
-	uint8_t& operator()(uint8_t col, uint8_t row) {
-		return mem[row + col * height];
-	};
-	uint8_t& operator()(pair loc) {
-		return mem[loc.y + loc.x * height];
-	};
-	board copy() {
-		board other;
-		other.width = width;
-		other.height = height;
-		other.mem = std::shared_ptr<uint8_t[]>(new uint8_t[width * height]);
-		for (std::size_t i{0}; i < width * height; ++i) {
-			other.mem[i] = mem[i];
-		}
-		return other;
-	};
-	bool check_connect4(uint8_t col, uint8_t row) {
-		const std::array<pair, 4> directions{pair{0, 1}, pair{1, 1}, pair{1, 0}, pair{1, -1}};
-		const uint8_t player{operator()(col, row)};
-		const pair pos{static_cast<int8_t>(col), static_cast<int8_t>(row)};
-		for (pair dir : directions) {
-			for (int8_t offset{0}; offset < 4; ++offset) {
-				pair start{pos - dir * offset};
-				if (start.x < 0 || start.x >= width || start.y < 0 || start.y >= height) {
-					// Outside of the board
-					continue;
-				}
-				bool check{true};
-				for (int8_t i{0}; i < 4; ++i) {
-					const pair elem{start + dir * i};
-					if (elem.x < 0 || elem.x >= width || elem.y < 0 || elem.y >= height) {
-						check = false;
-						break;
-					}
-					check = check && (operator()(elem) == player);
-				}
-				if (check) {
-					return true;
-				}
-			}
-		}
-		return false;
-	};
-	// Accepts possibly empty array and expands it
-	void serialize(std::vector<std::byte>& arr) {
-		const std::size_t size{(2 + width * height) * sizeof(uint8_t)};
-		const std::size_t old_size{arr.size()};
-		arr.resize(old_size + size, std::byte{0});
-		uint8_t* ints{reinterpret_cast<uint8_t*>(arr.data() + old_size)};
-		*ints++ = width;
-		*ints++ = height;
-		std::memcpy(ints, mem.get(), width * height);
-	};
-	std::size_t deserialize(const std::vector<std::byte>& arr) {
-		const uint8_t* ints{reinterpret_cast<const uint8_t*>(arr.data())};
-		width = *ints++;
-		height = *ints++;
-		mem = std::shared_ptr<uint8_t[]>(new uint8_t[width * height]);
-		std::memcpy(mem.get(), ints, width * height);
-		return (2 + width * height) * sizeof(uint8_t);
-	};
-};
-
-struct state {
-	board b;
-	uint8_t remaining_depth;
-	// Column: 0 .. WIDTH-1
-	uint8_t last_move_col;
-	// Computer or human move
-	uint8_t last_move_player;
-	double utility;
-
-	state() = default;
-	state(board b, uint8_t rem_d, uint8_t col, uint8_t player):
-		b{b},
-		remaining_depth{rem_d},
-		last_move_col{col},
-		last_move_player{player},
-		utility{0.0} {};
-	state(uint8_t w, uint8_t h, uint8_t rem_d, uint8_t col, uint8_t player):
-		b(w, h),
-		remaining_depth{rem_d},
-		last_move_col{col},
-		last_move_player{player},
-		utility{0.0} {};
-	// Accepts possibly empty array and expands it
-	void serialize(std::vector<std::byte>& arr) {
-		b.serialize(arr);
-		const std::size_t size{3*sizeof(uint8_t) + sizeof(double)};
-		const std::size_t old_size{arr.size()};
-		arr.resize(old_size + size, std::byte{0});
-		uint8_t* ints{reinterpret_cast<uint8_t*>(arr.data() + old_size)};
-		*ints++ = remaining_depth;
-		*ints++ = last_move_col;
-		*ints++ = last_move_player;
-		double* doubles{reinterpret_cast<double*>(ints)};
-		*doubles = utility;
-	};
-	std::size_t deserialize(const std::vector<std::byte>& arr) {
-		const std::size_t used{b.deserialize(arr)};
-		const uint8_t* ints{reinterpret_cast<const uint8_t*>(arr.data() + used)};
-		remaining_depth = *ints++;
-		last_move_col = *ints++;
-		last_move_player = *ints++;
-		const double* doubles{reinterpret_cast<const double*>(ints)};
-		utility = *doubles;
-		return used + 3 * sizeof(uint8_t) + sizeof(double);
-	};
-};
-
-struct node {
-	state s;
-	std::vector<std::shared_ptr<node>> children;
-
-	node(state s): s{s} {};
-	node() = default;
-};
-
-state read_state(const std::string filename);
-// Expects a starting state that is not a win.
-void build_sched_tree(std::shared_ptr<node> root, uint8_t sched_tree_depth, uint8_t max_depth);
-void generate_tasks_rec(std::vector<std::shared_ptr<node>>& tasks, std::shared_ptr<node> root);
-std::vector<std::shared_ptr<node>> generate_tasks(std::shared_ptr<node> root_node);
 void send_task(const int id, std::shared_ptr<node> task);
 void send_utility(double utility);
 void send_end_signal(int id);
 std::shared_ptr<node> receive_task();
 double receive_utility(const int id);
-double compute_utility(std::shared_ptr<node> root);
-void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size);
-void complete_computation(std::shared_ptr<node> root);
-pair select_best_move(std::shared_ptr<node> root);
-std::size_t count_nodes(std::shared_ptr<node> root);
+void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size, evaluator eval);
 
 int main(int argc, char* argv[]) {
-	MPI_Init(&argc, &argv);
+	// Only the main thread calls MPI, the log drainer doesn't
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
 	int rank, size;
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	logging::open("connect4", rank);
 
 	const std::string input{argv[1]};
 	const uint8_t max_depth{static_cast<uint8_t>(atoi(argv[2]))};
-	uint8_t sched_depth;
+	uint8_t sched_depth{0};
 	if (argc >= 4) {
 		sched_depth = static_cast<uint8_t>(atoi(argv[3]));
 	}
+	// Static evaluation used at the depth limit
+	evaluator eval{evaluate_zero};
+	if (argc >= 5) {
+		eval = select_evaluator(argv[4]);
+	}
 
 	if (rank == 0) {
 		// Read input
@@ -208,7 +54,8 @@ int main(int argc, char* argv[]) {
 		uint8_t sched_tree_depth{static_cast<uint8_t>(
 			1 + ceil(log(size) / log(initial.b.width))
 		)};
-		if (argc >= 4) {
+		if (argc >= 4 && sched_depth > 0) {
+			// Zero keeps the computed depth
 			sched_tree_depth = sched_depth;
 		}
 		if (sched_tree_depth >= max_depth) {
@@ -217,6 +64,8 @@ int main(int argc, char* argv[]) {
 
 		std::cout << "scheduling tree depth: " << int(sched_tree_depth) << std::endl;
 
+		const double start_time{MPI_Wtime()};
+
 		// Build the scheduling tree
 		std::shared_ptr<node> root_node{std::make_shared<node>(initial)};
 		build_sched_tree(root_node, sched_tree_depth, max_depth);
@@ -229,7 +78,7 @@ int main(int argc, char* argv[]) {
 			std::cout << "tasks len: " << tasks.size() << std::endl;
 
 		// Send tasks
-		distribute_tasks(tasks, size);
+		distribute_tasks(tasks, size, eval);
 		// Send the end signal
 		for (int id{1}; id < size; ++id) {
 			send_end_signal(id);
@@ -244,65 +93,33 @@ int main(int argc, char* argv[]) {
 
 		std::cout << "best move: col = " << move.x + 1 << std::endl;
 		std::cout << "root utility: " << root_node->s.utility << std::endl;
+		std::cout << "search time: " << MPI_Wtime() - start_time << " s" << std::endl;
 	} else {
+		int task_cnt{0};
 		while (true) {
 			// Accept the task
 			std::shared_ptr<node> task{receive_task()};
 			if (task == nullptr) {
+				LOG_INFO("worker %d done after %d tasks", rank, task_cnt);
+				logging::close();
 				MPI_Finalize();
 				return 0;
 			}
 			// Calculate the utility
-			const double utility{compute_utility(task)};
+			const double utility{compute_utility(task, eval)};
 			// Send utility to the root
-			std::cout << "worker " << rank << " sending utility " << utility << std::endl;
+			LOG_DEBUG("worker %d sending utility %f", rank, utility);
 			send_utility(utility);
+			task_cnt++;
 		}
 	}
 
+	logging::close();
 	MPI_Finalize();
 	return 0;
 }
 
-std::size_t count_nodes(std::shared_ptr<node> root) {
-	std::size_t subtree{1};
-	for (std::shared_ptr<node> subnode : root->children) {
-		subtree += count_nodes(subnode);
-	}
-	return subtree;
-}
-
-pair select_best_move(std::shared_ptr<node> root) {
-	double best_utility{-1.0};
-	pair best_move;
-	for (std::shared_ptr<node> subnode : root->children) {
-		if (subnode->s.utility >= best_utility) {
-			best_utility = subnode->s.utility;
-			uint8_t h{0};
-			while (h < subnode->s.b.height && subnode->s.b(subnode->s.last_move_col, h) != EMPTY) {
-				h++;
-			}
-			h--;
-			best_move = pair(subnode->s.last_move_col, h);
-		}
-	}
-	return best_move;
-}
-
-void complete_computation(std::shared_ptr<node> root) {
-	if (root->s.utility != 0.0) {
-		return;
-	}
-	double utility{0.0};
-	double size{static_cast<double>(root->children.size())};
-	for (std::shared_ptr<node> subnode : root->children) {
-		complete_computation(subnode);
-		utility += subnode->s.utility / size;
-	}
-	root->s.utility = utility;
-}
-
-void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size) {
+void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size, evaluator eval) {
 	// Currently distributed tasks
 	std::vector<std::shared_ptr<node>> id_work_task;
 	for (int i{0}; i < size; ++i) {
@@ -325,22 +142,24 @@ void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size) {
 			// Send the task
 			send_task(id, task);
 
-			std::cout << "sent task " << task_cnt++ << " to worker " << id << std::endl;
+			LOG_DEBUG("sent task %d to worker %d", task_cnt, id);
+			task_cnt++;
 		}
 		// Do root tasks
 		if (!tasks.empty()) {
 			std::shared_ptr<node> task{tasks.back()};
 			tasks.pop_back();
 
-			std::cout << "doing task " << task_cnt++ << " on root" << std::endl;
+			LOG_DEBUG("doing task %d on root", task_cnt);
+			task_cnt++;
 
 			// Do the task yourself
-			const double utility{compute_utility(task)};
+			const double utility{compute_utility(task, eval)};
 
 			// Erase subnodes so we don't repeat the computation later.
 			task->children.clear();
 
-			std::cout << "received utility " << utility << " from worker " << 0 << std::endl;
+			LOG_DEBUG("computed utility %f on root", utility);
 
 			// Update the node with the result
 			task->s.utility = utility;
@@ -355,7 +174,7 @@ void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size) {
 			// Wait for the result
 			const double utility{receive_utility(id)};
 
-			std::cout << "received utility " << utility << " from worker " << id << std::endl;
+			LOG_DEBUG("received utility %f from worker %d", utility, id);
 
 			// Update the node with the result
 			task->s.utility = utility;
@@ -364,79 +183,7 @@ void distribute_tasks(std::vector<std::shared_ptr<node>>& tasks, int size) {
 			id_work_task[id] = nullptr;
 		}
 	}
-}
-
-double compute_utility(std::shared_ptr<node> root) {
-	if (root->s.remaining_depth <= 0) {
-		return 0.0;
-	}
-	// Generate subnodes
-	for (uint8_t col{0}; col < root->s.b.width; ++col) {
-		// Compute the next valid move
-		uint8_t h{0};
-		while (
-			h < root->s.b.height
-			&& root->s.b(col, h) != EMPTY
-		) h++;
-		if (h == root->s.b.height) {
-			// The column is full, skip the column.
-			continue;
-		}
-
-		// Compute the player
-		uint8_t next_player{COMPUTER};
-		if (root->s.last_move_player == COMPUTER) {
-			next_player = HUMAN;
-		}
-
-		// Compute the board
-		board new_board{root->s.b.copy()};
-		new_board(col, h) = next_player;
-
-		// Compute the state
-		state new_state(
-			new_board,
-			root->s.remaining_depth - 1,
-			col,
-			next_player
-		);
-
-		// Check if there's connect 4
-		if (new_board.check_connect4(col, h)) {
-			if (next_player == COMPUTER) {
-				new_state.utility = 1.0;
-				// The computer always selects a move (subnode) that wins the game.
-				root->s.utility = 1.0;
-			} else {
-				new_state.utility = -1.0;
-				// Human can make a mistake
-			}
-		}
-
-		std::shared_ptr<node> new_node{std::make_shared<node>(new_state)};
-		if (new_state.utility == 1.0) {
-			// No need to consider other moves (subnodes).
-			// Root now has the computed utility.
-			root->children.clear();
-			root->children.push_back(new_node);
-			return 1.0;
-		}
-
-		root->children.push_back(new_node);
-		if (new_state.utility == -1.0) {
-			// Don't consider subnodes if a human won.
-			continue;
-		}
-
-		new_node->s.utility = compute_utility(new_node);
-	}
-
-	double utility{0.0};
-	double size{static_cast<double>(root->children.size())};
-	for (std::shared_ptr<node> subnode : root->children) {
-		utility += subnode->s.utility / size;
-	}
-	return utility;
+	LOG_INFO("distributed %d tasks", task_cnt);
 }
 
 double receive_utility(const int id) {
@@ -493,104 +240,3 @@ void send_task(const int id, std::shared_ptr<node> task) {
 		throw std::runtime_error("failed to send a task");
 	}
 }
-
-std::vector<std::shared_ptr<node>> generate_tasks(std::shared_ptr<node> root_node) {
-	std::vector<std::shared_ptr<node>> tasks;
-	generate_tasks_rec(tasks, root_node);
-	return tasks;
-}
-
-void generate_tasks_rec(std::vector<std::shared_ptr<node>>& tasks, std::shared_ptr<node> root) {
-	if (root->children.empty() && root->s.utility == 0.0) {
-		tasks.push_back(root);
-		return;
-	}
-	for (std::shared_ptr<node> subnode : root->children) {
-		generate_tasks_rec(tasks, subnode);
-	}
-}
-
-// Expects a starting state that is not a win.
-void build_sched_tree(std::shared_ptr<node> root, uint8_t sched_tree_depth, uint8_t max_depth) {
-	const uint8_t depth{static_cast<uint8_t>(max_depth - root->s.remaining_depth)};
-	if (depth >= sched_tree_depth) {
-		return;
-	}
-	// Generate subnodes
-	for (uint8_t col{0}; col < root->s.b.width; ++col) {
-		// Compute the next valid move
-		uint8_t h{0};
-		while (
-			h < root->s.b.height
-			&& root->s.b(col, h) != EMPTY
-		) h++;
-		if (h == root->s.b.height) {
-			// The column is full, skip the column.
-			continue;
-		}
-
-		// Compute the player
-		uint8_t next_player{COMPUTER};
-		if (root->s.last_move_player == COMPUTER) {
-			next_player = HUMAN;
-		}
-
-		// Compute the board
-		board new_board{root->s.b.copy()};
-		new_board(col, h) = next_player;
-
-		// Compute the state
-		state new_state(
-			new_board,
-			root->s.remaining_depth - 1,
-			col,
-			next_player
-		);
-
-		// Check if there's connect 4
-		if (new_board.check_connect4(col, h)) {
-			if (next_player == COMPUTER) {
-				new_state.utility = 1.0;
-				// The computer always selects a move (subnode) that wins the game.
-				root->s.utility = 1.0;
-			} else {
-				new_state.utility = -1.0;
-				// Human can make a mistake
-			}
-		}
-
-		std::shared_ptr<node> new_node{std::make_shared<node>(new_state)};
-		if (new_state.utility == 1.0) {
-			// No need to consider other moves (subnodes). The computer always makes the move that wins the game.
-			root->children.clear();
-			root->children.push_back(new_node);
-			return;
-		}
-
-		root->children.push_back(new_node);
-		if (new_state.utility == -1.0) {
-			// Don't consider subnodes if a human won.
-			continue;
-		}
-		build_sched_tree(new_node, sched_tree_depth, max_depth);
-	}
-}
-
-state read_state(const std::string filename) {
-	std::ifstream file(filename);
-
-	int width, height;
-
-	file >> height >> width;
-	board b(width, height);
-	for (int j{0}; j < height; ++j) {
-		for (int i{0}; i < width; ++i) {
-			int field;
-			file >> field;
-			b(i, height - 1 - j) = static_cast<uint8_t>(field);
-		}
-	}
-
-	return state(b, 0, 0, HUMAN);
-}
-
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Strong scaling driver for the dz2 solver.
+
+Runs the MPI binary over 1..N ranks and several scheduling depths and writes
+a speedup/efficiency report as JSON and Markdown. A previous JSON report can
+be passed with --baseline to compare the times against an older run.
+"""
+
+import argparse
+import json
+import platform
+import re
+import subprocess
+import sys
+from datetime import datetime, timezone
+
+TIME_RE = re.compile(r"search time: ([0-9.eE+-]+) s")
+MOVE_RE = re.compile(r"best move: col = (\d+)")
+
+
+def run(args, ranks, sched_depth):
+    cmd = [args.mpiexec, "-n", str(ranks), *args.mpiexec_args,
+           args.binary, args.board, str(args.depth), str(sched_depth), args.evaluator]
+    times = []
+    move = None
+    for _ in range(args.repeat):
+        out = subprocess.run(cmd, check=True, capture_output=True, text=True).stdout
+        times.append(float(TIME_RE.search(out).group(1)))
+        move = int(MOVE_RE.search(out).group(1))
+    return min(times), move
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--binary", default="./main")
+    parser.add_argument("--board", default="board.txt")
+    parser.add_argument("--depth", type=int, default=10)
+    parser.add_argument("--evaluator", default="zero")
+    parser.add_argument("--max-ranks", type=int, default=8)
+    parser.add_argument("--sched-depths", default="2,3,4",
+                        help="comma separated scheduling tree depths")
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="runs per configuration, the fastest one is reported")
+    parser.add_argument("--mpiexec", default="mpiexec")
+    parser.add_argument("--mpiexec-args", default="",
+                        help="extra arguments for mpiexec, e.g. '--oversubscribe'")
+    parser.add_argument("--baseline", help="previous JSON report to compare against")
+    parser.add_argument("--output", default="scaling",
+                        help="report name, writes <output>.json and <output>.md")
+    args = parser.parse_args()
+    args.mpiexec_args = args.mpiexec_args.split()
+
+    runs = []
+    for sched_depth in [int(d) for d in args.sched_depths.split(",")]:
+        serial = None
+        for ranks in range(1, args.max_ranks + 1):
+            time, move = run(args, ranks, sched_depth)
+            if serial is None:
+                serial = time
+            runs.append({
+                "ranks": ranks,
+                "sched_depth": sched_depth,
+                "time": time,
+                "speedup": serial / time,
+                "efficiency": serial / time / ranks,
+                "move": move,
+            })
+            print(f"sched depth {sched_depth}, {ranks} ranks: {time:.3f} s", file=sys.stderr)
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            for r in json.load(f)["runs"]:
+                baseline[(r["ranks"], r["sched_depth"])] = r
+
+    report = {
+        "host": platform.node(),
+        "date": datetime.now(timezone.utc).isoformat(timespec="seconds"),
+        "board": args.board,
+        "depth": args.depth,
+        "evaluator": args.evaluator,
+        "runs": runs,
+    }
+    with open(args.output + ".json", "w") as f:
+        json.dump(report, f, indent="\t")
+
+    with open(args.output + ".md", "w") as f:
+        f.write(f"{report['host']}, {report['date']}\n\n")
+        f.write(f"board: {args.board}, depth: {args.depth}, evaluator: {args.evaluator}\n\n")
+        header = "| Sched depth | Proc | Time | Speedup | Efficiency | Move |"
+        rule = "| ---         | ---  | ---: | ---:    | ---:       | ---: |"
+        if baseline:
+            header += " Baseline | Ratio |"
+            rule += " ---:     | ---:  |"
+        f.write(header + "\n" + rule + "\n")
+        for r in runs:
+            line = (f"| {r['sched_depth']} | {r['ranks']} | {r['time']:.3f} | {r['speedup']:.2f}"
+                    f" | {r['efficiency']:.2f} | {r['move']} |")
+            if baseline:
+                old = baseline.get((r["ranks"], r["sched_depth"]))
+                if old is None:
+                    line += " - | - |"
+                else:
+                    flag = "" if old["move"] == r["move"] else " (move changed)"
+                    line += f" {old['time']:.3f} | {r['time'] / old['time']:.2f}{flag} |"
+            f.write(line + "\n")
+
+
+if __name__ == "__main__":
+    main()
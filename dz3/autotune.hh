@@ -0,0 +1,187 @@
+#pragma once
+
+// Include after CL/cl.hpp with exceptions enabled, like the programs do.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+// How to launch a kernel: the work-group shape, 0 leaves the dimension to the
+// implementation, and how many items of the problem one work item takes.
+struct Launch {
+	std::size_t local[2]{0, 0};
+	std::size_t work_per_item{1};
+};
+
+// Picks the fastest launch of a kernel on a device by timing every candidate once and
+// remembers it in a cache file, so only the first run of a program on a device pays for
+// the sweep. Entries are keyed by the device name and a kernel key that the caller makes
+// specific enough, e.g. the kernel name with the problem size.
+//
+// The file is AUTOTUNE_CACHE, autotune.cache in the working directory by default;
+// AUTOTUNE_CACHE= (empty) keeps the results in memory only.
+class Autotuner {
+private:
+	std::string device_name;
+	std::string path;
+	// "device\tkernel" -> launch
+	std::map<std::string, Launch> entries;
+
+	std::string entry_key(const std::string& kernel) const {
+		return device_name + '\t' + kernel;
+	}
+
+	void load() {
+		std::ifstream file(path);
+		std::string line;
+		while (std::getline(file, line)) {
+			// device \t kernel \t local0 local1 work_per_item
+			const std::size_t second{line.find('\t')};
+			const std::size_t third{second == std::string::npos ? second : line.find('\t', second + 1)};
+			if (third == std::string::npos) continue;
+			Launch launch;
+			std::istringstream values(line.substr(third + 1));
+			if (!(values >> launch.local[0] >> launch.local[1] >> launch.work_per_item) || launch.work_per_item == 0) continue;
+			entries[line.substr(0, third)] = launch;
+		}
+	}
+
+	void save() const {
+		if (path.empty()) return;
+		// Written whole and renamed over the old file, so a concurrent run reads either
+		const std::string temporary{path + ".tmp"};
+		{
+			std::ofstream file(temporary, std::ios::trunc);
+			for (const auto& [key, launch] : entries) {
+				file << key << '\t' << launch.local[0] << ' ' << launch.local[1] << ' ' << launch.work_per_item << '\n';
+			}
+			if (!file) {
+				std::cerr << "Can't write the autotuning cache " << temporary << std::endl;
+				return;
+			}
+		}
+		if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+			std::cerr << "Can't replace the autotuning cache " << path << std::endl;
+		}
+	}
+
+public:
+	explicit Autotuner(const cl::Device& device) {
+		device_name = device.getInfo<CL_DEVICE_NAME>();
+		// Tabs and newlines separate the fields of the cache
+		for (char& c : device_name) {
+			if (c == '\t' || c == '\n') c = ' ';
+		}
+		const char* env{std::getenv("AUTOTUNE_CACHE")};
+		path = env != nullptr ? env : "autotune.cache";
+		if (!path.empty()) load();
+	}
+
+	// The cached launch of the kernel, if it was tuned before on this device
+	bool lookup(const std::string& kernel, Launch& launch) const {
+		const auto it{entries.find(entry_key(kernel))};
+		if (it == entries.end()) return false;
+		launch = it->second;
+		return true;
+	}
+
+	// Returns the cached launch or times run(candidate), which must enqueue the kernel with
+	// that launch and wait for it, for every candidate, and caches the fastest. Candidates
+	// that throw cl::Error, e.g. CL_INVALID_WORK_GROUP_SIZE or CL_OUT_OF_RESOURCES, are
+	// skipped. The first candidate also runs once untimed to warm up the device.
+	template <typename Run>
+	Launch tune(const std::string& kernel, const std::vector<Launch>& candidates, Run run) {
+		Launch best;
+		if (lookup(kernel, best)) return best;
+		double best_time{-1.0};
+		bool is_warm{false};
+		for (const Launch& candidate : candidates) {
+			try {
+				if (!is_warm) {
+					run(candidate);
+					is_warm = true;
+				}
+				const auto start{std::chrono::steady_clock::now()};
+				run(candidate);
+				const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+				#ifdef DEBUG
+				std::cout << "Autotuning " << kernel << ": " << candidate.local[0] << 'x' << candidate.local[1]
+					<< ", " << candidate.work_per_item << " per item, " << elapsed.count() * 1e3 << " ms" << std::endl;
+				#endif
+				if (best_time < 0.0 || elapsed.count() < best_time) {
+					best_time = elapsed.count();
+					best = candidate;
+				}
+			} catch (const cl::Error& e) {
+				#ifdef DEBUG
+				std::cout << "Autotuning " << kernel << ": " << candidate.local[0] << 'x' << candidate.local[1]
+					<< ", " << candidate.work_per_item << " per item failed, " << e.what() << " (" << e.err() << ")" << std::endl;
+				#endif
+			}
+		}
+		if (best_time < 0.0) {
+			// Nothing ran, don't remember it and let the caller's own launch report the error
+			return Launch{};
+		}
+		entries[entry_key(kernel)] = best;
+		save();
+		return best;
+	}
+
+	// Work-group sizes the kernel can be launched with on the device: powers of two times
+	// the preferred multiple up to CL_KERNEL_WORK_GROUP_SIZE, which can be below the device
+	// maximum for kernels that use many registers.
+	static std::vector<std::size_t> group_sizes(const cl::Kernel& kernel, const cl::Device& device) {
+		const std::size_t limit{kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)};
+		std::size_t size{kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device)};
+		if (size == 0 || size > limit) size = 1;
+		std::vector<std::size_t> sizes;
+		for (; size <= limit; size *= 2) {
+			sizes.push_back(size);
+		}
+		return sizes;
+	}
+
+	// One-dimensional candidates: every group size, and the implementation's choice, for
+	// each work per item
+	static std::vector<Launch> ranges(const cl::Kernel& kernel, const cl::Device& device, const std::vector<std::size_t>& work_per_item) {
+		std::vector<Launch> candidates;
+		for (const std::size_t work : work_per_item) {
+			Launch launch;
+			launch.work_per_item = work;
+			candidates.push_back(launch);
+			for (const std::size_t size : group_sizes(kernel, device)) {
+				launch.local[0] = size;
+				candidates.push_back(launch);
+			}
+		}
+		return candidates;
+	}
+
+	// Two-dimensional candidates: rows x columns shapes of every group size, at least four
+	// columns wide where the group is, since the columns are the contiguous dimension, and
+	// the implementation's choice, for each work per item along the columns
+	static std::vector<Launch> tiles(const cl::Kernel& kernel, const cl::Device& device, const std::vector<std::size_t>& work_per_item) {
+		std::vector<Launch> candidates;
+		for (const std::size_t work : work_per_item) {
+			Launch launch;
+			launch.work_per_item = work;
+			candidates.push_back(launch);
+			for (const std::size_t size : group_sizes(kernel, device)) {
+				for (std::size_t columns{size}; columns >= 4 || columns == size; columns /= 2) {
+					launch.local[0] = size / columns;
+					launch.local[1] = columns;
+					candidates.push_back(launch);
+				}
+			}
+		}
+		return candidates;
+	}
+};
@@ -8,6 +8,8 @@
 #include <memory>
 #include <algorithm>
 
+#include "profile.hh"
+
 #define check_err(s) {\
 	try {\
 		s;\
@@ -18,6 +20,7 @@
 }
 
 int main(int argc, char* argv[]) {
+	Profiler profiler;
 
 	try {
 		std::vector<cl::Platform> platforms;
@@ -63,7 +66,7 @@ int main(int argc, char* argv[]) {
 		std::cout << "Selected device: " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
 
 		cl::Context context(device);
-		cl::CommandQueue queue(context, device);
+		cl::CommandQueue queue(context, device, profiler.queue_properties());
 		
 		std::string source{R"CLC(
 			kernel void add(global const float* A, global const float* B, global float* C) {
@@ -87,16 +90,18 @@ int main(int argc, char* argv[]) {
 		std::vector<float> C(N, 0.0f);
 
 		cl::Kernel kernel(program, "add");
-		cl::Buffer buf_a(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(float), A.data());
-		cl::Buffer buf_b(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(float), B.data());
+		cl::Buffer buf_a(context, CL_MEM_READ_ONLY, N * sizeof(float));
+		cl::Buffer buf_b(context, CL_MEM_READ_ONLY, N * sizeof(float));
 		cl::Buffer buf_c(context, CL_MEM_WRITE_ONLY, N * sizeof(float));
+		check_err(queue.enqueueWriteBuffer(buf_a, CL_FALSE, 0, N * sizeof(float), A.data(), nullptr, profiler.record("A")));
+		check_err(queue.enqueueWriteBuffer(buf_b, CL_FALSE, 0, N * sizeof(float), B.data(), nullptr, profiler.record("B")));
 		check_err(kernel.setArg(0, buf_a));
 		check_err(kernel.setArg(1, buf_b));
 		check_err(kernel.setArg(2, buf_c));
 
-		check_err(queue.enqueueNDRangeKernel(kernel, 0, N));
+		check_err(queue.enqueueNDRangeKernel(kernel, 0, N, cl::NullRange, nullptr, profiler.record("add")));
 		check_err(queue.finish());
-		check_err(queue.enqueueReadBuffer(buf_c, CL_TRUE, 0, N * sizeof(float), C.data()));
+		check_err(queue.enqueueReadBuffer(buf_c, CL_TRUE, 0, N * sizeof(float), C.data(), nullptr, profiler.record("C")));
 
 
 		// Check that data matches the performed computation.
@@ -106,6 +111,7 @@ int main(int argc, char* argv[]) {
 				return -1;
 			}
 		}
+		profiler.report();
 
 	} catch (cl::Error e) {
 		std::cerr << e.what() << " (" << e.err() << ")" << std::endl;
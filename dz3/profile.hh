@@ -0,0 +1,167 @@
+#pragma once
+
+// Include after CL/cl.hpp, like the programs do.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <utility>
+
+// Optional event profiling of everything the programs enqueue. OPENCL_PROFILE=<file>
+// turns it on: queues are created with CL_QUEUE_PROFILING_ENABLE, every command passes
+// record() as its event, and report() prints count, total, mean and p99 of the device
+// time per command type and writes the commands as a Chrome trace (chrome://tracing,
+// Perfetto) to the file. Without it record() returns nullptr and nothing is kept.
+class Profiler {
+private:
+	struct Command {
+		std::string name;
+		cl_command_type type;
+		cl_ulong queued;
+		cl_ulong submit;
+		cl_ulong start;
+		cl_ulong end;
+	};
+
+	std::string path;
+	bool is_enabled{false};
+	bool is_reported{false};
+	// Enqueued, timestamps not read yet
+	std::deque<std::pair<std::string, cl::Event>> pending;
+	std::vector<Command> commands;
+	std::chrono::steady_clock::time_point created{std::chrono::steady_clock::now()};
+
+	// Waits for the oldest count pending commands and keeps only their timestamps, so
+	// long runs don't hold on to thousands of events
+	void resolve(std::size_t count) {
+		for (; count > 0 && !pending.empty(); --count) {
+			auto& [name, event] = pending.front();
+			event.wait();
+			Command command;
+			command.name = name;
+			command.type = event.getInfo<CL_EVENT_COMMAND_TYPE>();
+			command.queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			command.submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+			command.start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			command.end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			commands.push_back(command);
+			pending.pop_front();
+		}
+	}
+
+	static const char* type_name(cl_command_type type) {
+		switch (type) {
+			case CL_COMMAND_NDRANGE_KERNEL: return "kernel";
+			case CL_COMMAND_READ_BUFFER: return "read";
+			case CL_COMMAND_WRITE_BUFFER: return "write";
+			case CL_COMMAND_COPY_BUFFER: return "copy";
+			case CL_COMMAND_FILL_BUFFER: return "fill";
+			case CL_COMMAND_MAP_BUFFER: return "map";
+			case CL_COMMAND_UNMAP_MEM_OBJECT: return "unmap";
+			default: return "other";
+		}
+	}
+
+	void write_trace(cl_ulong origin) const {
+		std::ofstream file(path, std::ios::trunc);
+		// One row for kernels and one for transfers, so overlap between them shows
+		file << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+		file << std::fixed << std::setprecision(3);
+		for (const Command& c : commands) {
+			const bool is_kernel{c.type == CL_COMMAND_NDRANGE_KERNEL};
+			file << "{\"name\": \"" << c.name << "\", \"cat\": \"" << type_name(c.type) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+				<< (is_kernel ? 1 : 2) << ", \"ts\": " << (c.start - origin) / 1e3 << ", \"dur\": " << (c.end - c.start) / 1e3
+				<< ", \"args\": {\"queued_us\": " << (c.start - c.queued) / 1e3 << ", \"submitted_us\": " << (c.start - c.submit) / 1e3
+				<< "}},\n";
+		}
+		file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"kernels\"}},\n";
+		file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"transfers\"}}\n";
+		file << "]}\n";
+		if (!file) {
+			std::cerr << "Can't write the trace " << path << std::endl;
+		}
+	}
+
+public:
+	Profiler() {
+		const char* env{std::getenv("OPENCL_PROFILE")};
+		if (env != nullptr && env[0] != '\0') {
+			path = env;
+			is_enabled = true;
+		}
+	}
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	bool enabled() const {
+		return is_enabled;
+	}
+
+	// Properties for the cl::CommandQueue constructor
+	cl_command_queue_properties queue_properties() const {
+		return is_enabled ? CL_QUEUE_PROFILING_ENABLE : 0;
+	}
+
+	// Event to pass to an enqueue call, nullptr when profiling is off. Use it right away,
+	// a later call may drop it.
+	cl::Event* record(const std::string& name) {
+		if (!is_enabled) return nullptr;
+		if (pending.size() >= 1024) resolve(512);
+		pending.emplace_back(name, cl::Event());
+		return &pending.back().second;
+	}
+
+	// Waits for everything recorded, prints the summary and writes the trace. Only the
+	// first call does anything.
+	void report() {
+		if (!is_enabled || is_reported) return;
+		is_reported = true;
+		resolve(pending.size());
+		const std::chrono::duration<double> wall{std::chrono::steady_clock::now() - created};
+		if (commands.empty()) {
+			std::cout << "No OpenCL commands were profiled" << std::endl;
+			return;
+		}
+
+		// Durations in ns per type and name, e.g. "kernel step" or "read psi"
+		std::map<std::string, std::vector<cl_ulong>> groups;
+		cl_ulong origin{commands.front().queued};
+		cl_ulong last{0};
+		cl_ulong busy{0};
+		for (const Command& c : commands) {
+			groups[std::string(type_name(c.type)) + ' ' + c.name].push_back(c.end - c.start);
+			origin = std::min(origin, c.queued);
+			last = std::max(last, c.end);
+			busy += c.end - c.start;
+		}
+
+		std::cout << "\nOpenCL profile\n";
+		std::cout << std::left << std::setw(28) << "Command" << std::right << std::setw(10) << "Count"
+			<< std::setw(14) << "Total (ms)" << std::setw(14) << "Mean (us)" << std::setw(14) << "p99 (us)" << '\n';
+		std::cout << std::fixed << std::setprecision(3);
+		for (auto& [name, durations] : groups) {
+			std::sort(durations.begin(), durations.end());
+			cl_ulong total{0};
+			for (const cl_ulong d : durations) {
+				total += d;
+			}
+			const std::size_t p99{(durations.size() * 99 + 99) / 100 - 1};
+			std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << durations.size()
+				<< std::setw(14) << total / 1e6 << std::setw(14) << total / 1e3 / durations.size()
+				<< std::setw(14) << durations[p99] / 1e3 << '\n';
+		}
+		// What the device didn't spend on commands went to the host: setup, loops and waits
+		std::cout << "Device busy " << busy / 1e6 << " ms of " << (last - origin) / 1e6 << " ms from the first command to the last, "
+			<< wall.count() * 1e3 << " ms since the profiler started" << std::endl;
+		std::cout << std::defaultfloat;
+		write_trace(origin);
+		std::cout << "Wrote the trace of " << commands.size() << " commands to " << path << std::endl;
+	}
+};
@@ -13,6 +13,11 @@
 #include <stdexcept>
 #include <cmath>
 #include <cstdint>
+#include <string>
+#include <cstring>
+
+#include "autotune.hh"
+#include "profile.hh"
 
 #define check(s) {\
 	try {\
@@ -25,11 +30,17 @@
 
 int main(int argc, char* argv[]) {
 	if (argc < 3) {
-		std::cerr << argv[0] << " <num_of_cities> <work_per_thread> [<seed>]" << std::endl;
+		std::cerr << argv[0] << " <num_of_cities> <work_per_thread|auto> [<seed>]" << std::endl;
 		return -1;
 	}
 	const uint64_t work_size{std::strtoull(argv[1], nullptr, 10)};
-	const uint64_t work_per_thread{std::strtoull(argv[2], nullptr, 10)};
+	// "auto" tunes the work per thread and the work group size, timing the candidates on the first run
+	const bool is_tuned{std::strcmp(argv[2], "auto") == 0};
+	uint64_t work_per_thread{is_tuned ? 1 : std::strtoull(argv[2], nullptr, 10)};
+	if (work_per_thread == 0 || work_per_thread > work_size) {
+		std::cerr << "The work per thread must be between 1 and the number of cities" << std::endl;
+		return -1;
+	}
 	uint64_t seed{0};
 	bool seed_set{false};
 	if (argc > 3) {
@@ -37,6 +48,7 @@ int main(int argc, char* argv[]) {
 		seed = std::strtoull(argv[3], nullptr, 10);
 	}
 
+	Profiler profiler;
 	try {
 		std::vector<cl::Platform> platforms;
 		cl::Platform::get(&platforms);
@@ -93,7 +105,7 @@ int main(int argc, char* argv[]) {
 		#endif
 
 		cl::Context context(device);
-		cl::CommandQueue queue(context, device);
+		cl::CommandQueue queue(context, device, profiler.queue_properties());
 		
 		std::string source{R"CLC(
 			kernel void sum(
@@ -174,20 +186,48 @@ int main(int argc, char* argv[]) {
 			Y[i] = dist(gen);
 		}
 
-		const uint64_t threads_cnt{work_size / work_per_thread};
 		cl::Kernel kernel(program, "sum");
-		cl::Buffer buf_a(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, work_size * sizeof(double), X.data());
-		cl::Buffer buf_b(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, work_size * sizeof(double), Y.data());
+		cl::Buffer buf_a(context, CL_MEM_READ_ONLY, work_size * sizeof(double));
+		cl::Buffer buf_b(context, CL_MEM_READ_ONLY, work_size * sizeof(double));
 		cl::Buffer buf_c(context, CL_MEM_WRITE_ONLY, work_size * sizeof(double));
+		check(queue.enqueueWriteBuffer(buf_a, CL_FALSE, 0, work_size * sizeof(double), X.data(), nullptr, profiler.record("X")));
+		check(queue.enqueueWriteBuffer(buf_b, CL_FALSE, 0, work_size * sizeof(double), Y.data(), nullptr, profiler.record("Y")));
 		check(kernel.setArg(0, buf_a));
 		check(kernel.setArg(1, buf_b));
 		check(kernel.setArg(2, buf_c));
 		check(kernel.setArg(3, static_cast<int>(work_size)));
+
+		cl::NDRange local{cl::NullRange};
+		if (is_tuned) {
+			// Every candidate computes all the distances once
+			std::vector<std::size_t> works;
+			for (std::size_t work{1}; work <= 16 && work <= work_size; work *= 2) {
+				works.push_back(work);
+			}
+			Autotuner tuner(device);
+			const Launch best{tuner.tune("zad1 sum " + std::to_string(work_size), Autotuner::ranges(kernel, device, works), [&](const Launch& launch) {
+				kernel.setArg(4, static_cast<int>(launch.work_per_item));
+				const std::size_t threads{work_size / launch.work_per_item};
+				queue.enqueueNDRangeKernel(kernel, 0, threads, launch.local[0] == 0 ? cl::NullRange : cl::NDRange(launch.local[0]));
+				queue.finish();
+			})};
+			work_per_thread = best.work_per_item;
+			if (best.local[0] != 0) {
+				local = cl::NDRange(best.local[0]);
+			}
+			std::cout << "Work per thread: " << work_per_thread << ", work group size: ";
+			if (best.local[0] != 0) {
+				std::cout << best.local[0] << std::endl;
+			} else {
+				std::cout << "left to the implementation" << std::endl;
+			}
+		}
+		const uint64_t threads_cnt{work_size / work_per_thread};
 		check(kernel.setArg(4, static_cast<int>(work_per_thread)));
 
-		check(queue.enqueueNDRangeKernel(kernel, 0, threads_cnt));
+		check(queue.enqueueNDRangeKernel(kernel, 0, threads_cnt, local, nullptr, profiler.record("sum")));
 		check(queue.finish());
-		check(queue.enqueueReadBuffer(buf_c, CL_TRUE, 0, work_size * sizeof(double), R.data()));
+		check(queue.enqueueReadBuffer(buf_c, CL_TRUE, 0, work_size * sizeof(double), R.data(), nullptr, profiler.record("C")));
 
 		double avg{0.0};
 		double total_distances{(work_size * (work_size - 1)) / 2.0};
@@ -195,6 +235,7 @@ int main(int argc, char* argv[]) {
 			avg += R[i] / total_distances;
 		}
 		std::cout << "Average distance: " << avg << std::endl;
+		profiler.report();
 
 	} catch (cl::Error e) {
 		std::cerr << e.what() << " (" << e.err() << ")" << std::endl;
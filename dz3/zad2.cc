@@ -14,6 +14,11 @@
 #include <cmath>
 #include <cstdint>
 #include <iomanip>
+#include <string>
+#include <cstring>
+
+#include "autotune.hh"
+#include "profile.hh"
 
 #define check(s) {\
 	try {\
@@ -26,23 +31,30 @@
 
 int main(int argc, char* argv[]) {
 	if (argc < 3) {
-		std::cerr << argv[0] << " <work_size> <work_per_thread> [<work_group_size>]" << std::endl;
+		std::cerr << argv[0] << " <work_size> <work_per_thread|auto> [<work_group_size>|auto]" << std::endl;
 		return -1;
 	}
 	uint64_t work_size{static_cast<uint64_t>(std::strtoull(argv[1], nullptr, 10))};
-	bool is_work_per_thread_set{false};
-	uint64_t work_per_thread;
-	if (argc >= 3) {
-		is_work_per_thread_set = true;
+	// "auto" picks the value with the autotuner, timing the candidates on the first run
+	const bool is_work_per_thread_auto{std::strcmp(argv[2], "auto") == 0};
+	uint64_t work_per_thread{1};
+	if (!is_work_per_thread_auto) {
 		work_per_thread = static_cast<uint64_t>(std::strtoull(argv[2], nullptr, 10));
 	}
 	bool is_work_group_size_set{false};
+	bool is_work_group_size_auto{is_work_per_thread_auto};
 	uint64_t work_group_size;
 	if (argc >= 4) {
-		is_work_group_size_set = true;
+		is_work_group_size_auto = std::strcmp(argv[3], "auto") == 0;
+		is_work_group_size_set = !is_work_group_size_auto;
 		work_group_size = static_cast<uint64_t>(std::strtoull(argv[3], nullptr, 10));
 	}
+	if (work_size == 0 || (!is_work_per_thread_auto && work_per_thread == 0)) {
+		std::cerr << "The work size and the work per thread must be positive" << std::endl;
+		return -1;
+	}
 
+	Profiler profiler;
 	try {
 		std::vector<cl::Platform> platforms;
 		cl::Platform::get(&platforms);
@@ -99,7 +111,7 @@ int main(int argc, char* argv[]) {
 		#endif
 
 		cl::Context context(device);
-		cl::CommandQueue queue(context, device);
+		cl::CommandQueue queue(context, device, profiler.queue_properties());
 		
 		std::string source{R"CLC(
 			kernel void sum(const unsigned long work_size, const unsigned long work_per_thread, global double* results) {
@@ -131,23 +143,65 @@ int main(int argc, char* argv[]) {
 		}
 
 
+		cl::Kernel kernel(program, "sum");
+
+		if (is_work_per_thread_auto || is_work_group_size_auto) {
+			// Runs the whole sum once per candidate. The Error cases of the work group size
+			// benchmark are launches over CL_KERNEL_WORK_GROUP_SIZE, they are left out here.
+			const std::vector<std::size_t> works{is_work_per_thread_auto ?
+				std::vector<std::size_t>{1, 10, 100, 1000, 10000} : std::vector<std::size_t>{work_per_thread}};
+			std::vector<Launch> candidates{Autotuner::ranges(kernel, device, works)};
+			if (!is_work_group_size_auto) {
+				// Only the work per thread is tuned, keep the given work group size
+				std::vector<Launch> given;
+				for (Launch launch : candidates) {
+					if (launch.local[0] == 0) {
+						launch.local[0] = is_work_group_size_set ? work_group_size : 0;
+						given.push_back(launch);
+					}
+				}
+				candidates = given;
+			}
+			const std::string key{"zad2 sum " + std::to_string(work_size) +
+				(is_work_per_thread_auto ? "" : " per thread " + std::to_string(work_per_thread)) +
+				(is_work_group_size_auto ? "" : " group " + std::string(is_work_group_size_set ? argv[3] : "default"))};
+			Autotuner tuner(device);
+			const Launch best{tuner.tune(key, candidates, [&](const Launch& launch) {
+				const uint64_t threads{(work_size + launch.work_per_item - 1) / launch.work_per_item};
+				cl::Buffer buffer(context, CL_MEM_WRITE_ONLY, threads * sizeof(double));
+				kernel.setArg(0, work_size);
+				kernel.setArg(1, static_cast<uint64_t>(launch.work_per_item));
+				kernel.setArg(2, buffer);
+				queue.enqueueNDRangeKernel(kernel, 0, threads, launch.local[0] == 0 ? cl::NullRange : cl::NDRange(launch.local[0]));
+				queue.finish();
+			})};
+			work_per_thread = best.work_per_item;
+			is_work_group_size_set = best.local[0] != 0;
+			work_group_size = best.local[0];
+			std::cout << "Work per thread: " << work_per_thread << ", work group size: ";
+			if (is_work_group_size_set) {
+				std::cout << work_group_size << std::endl;
+			} else {
+				std::cout << "left to the implementation" << std::endl;
+			}
+		}
+
 		const uint64_t threads_cnt{(work_size + work_per_thread - 1) / work_per_thread};
 
 		std::vector<double> results(threads_cnt, 0.0);
 
-		cl::Kernel kernel(program, "sum");
 		cl::Buffer buf_results(context, CL_MEM_WRITE_ONLY, threads_cnt * sizeof(double));
 		check(kernel.setArg(0, work_size));
 		check(kernel.setArg(1, work_per_thread));
 		check(kernel.setArg(2, buf_results));
 
 		if (is_work_group_size_set) {
-			check(queue.enqueueNDRangeKernel(kernel, 0, threads_cnt, work_group_size));
+			check(queue.enqueueNDRangeKernel(kernel, 0, threads_cnt, work_group_size, nullptr, profiler.record("sum")));
 		} else {
-			check(queue.enqueueNDRangeKernel(kernel, 0, threads_cnt));
+			check(queue.enqueueNDRangeKernel(kernel, 0, threads_cnt, cl::NullRange, nullptr, profiler.record("sum")));
 		}
 		check(queue.finish());
-		check(queue.enqueueReadBuffer(buf_results, CL_TRUE, 0, threads_cnt * sizeof(double), results.data()));
+		check(queue.enqueueReadBuffer(buf_results, CL_TRUE, 0, threads_cnt * sizeof(double), results.data(), nullptr, profiler.record("results")));
 
 		double pi{0.0};
 		for (double result : results) {
@@ -157,6 +211,7 @@ int main(int argc, char* argv[]) {
 		const double PI25DT{3.141592653589793238462643};
 		std::cout << "Approximated Pi: " << std::setprecision(16) << pi << std::endl;
 		std::cout << "Error: " << fabs(pi - PI25DT) << std::endl;
+		profiler.report();
 
 	} catch (cl::Error e) {
 		std::cerr << e.what() << " (" << e.err() << ")" << std::endl;
@@ -1,34 +1,72 @@
 #include "boundary.h"
 #include <stdio.h>
 
-//grid is parallelised in the x direction
+void boundarypsi(double* psi, cfdgrid g, int b, int h, int w)
+{
+	boundarypsi(psi,g,b,h,w,0,g.m+1);
+}
+
 
-void boundarypsi(double* psi, int m, int n, int b, int h, int w)
+void boundarypsi(double* psi, cfdgrid g, int b, int h, int w, int first, int last)
 {
 
+	const int m=g.m, p=g.pitch;
 	int i,j;
 
-	//BCs on bottom edge
+	//BCs on bottom edge, one value in each row
 
 	for (i=b+1;i<=b+w-1;i++)
 	{
-		psi[i*(m+2)+0] = (double)(i-b);
+		if (i >= first && i <= last) psi[(i-first)*p+0] = (double)(i-b);
 	}
 
 	for (i=b+w;i<=m;i++)
 	{
-		psi[i*(m+2)+0] = (double)(w);
+		if (i >= first && i <= last) psi[(i-first)*p+0] = (double)(w);
 	}
 
-	//BCS on RHS
+	//BCS on RHS, all in the last row
+
+	if (m+1 < first || m+1 > last) return;
 
 	for (j=1; j <= h; j++)
 	{
-		psi[(m+1)*(m+2)+j] = (double) w;
+		psi[(m+1-first)*p+j] = (double) w;
 	}
 
 	for (j=h+1;j<=h+w-1; j++)
 	{
-		psi[(m+1)*(m+2)+j]=(double)(w-j+h);
+		psi[(m+1-first)*p+j]=(double)(w-j+h);
 	}
 }
+
+
+void boundaryzet(double* zet, const double* psi, cfdgrid g)
+{
+
+	const int m=g.m, n=g.n, p=g.pitch;
+	int i,j;
+
+	//set top/bottom BCs:
+
+	for (i=1;i<m+1;i++)
+	{
+		zet[i*p+0]   = 2.0*(psi[i*p+1]-psi[i*p+0]);
+		zet[i*p+n+1] = 2.0*(psi[i*p+n]-psi[i*p+n+1]);
+	}
+
+	//set left BCs:
+
+	for (j=1;j<n+1;j++)
+	{
+		zet[0*p+j] = 2.0*(psi[1*p+j]-psi[0*p+j]);
+	}
+
+	//set right BCs
+
+	for (j=1;j<n+1;j++)
+	{
+		zet[(m+1)*p+j] = 2.0*(psi[m*p+j]-psi[(m+1)*p+j]);
+	}
+}
+
@@ -2,4 +2,13 @@
 
 #include <vector>
 
-void boundarypsi(double* psi, int m, int n, int b, int h, int w);
+#include "grid.h"
+
+void boundarypsi(double* psi, cfdgrid g, int b, int h, int w);
+
+// Only the rows first to last of the grid g, stored from psi[0] with the pitch of g,
+// e.g. the slab of one rank with its halo rows
+void boundarypsi(double* psi, cfdgrid g, int b, int h, int w, int first, int last);
+
+// Vorticity on the walls from the stream function next to them
+void boundaryzet(double* zet, const double* psi, cfdgrid g);
@@ -1,11 +1,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+
+#include <stdexcept>
 
 #include "arraymalloc.h"
 #include "boundary.h"
 #include "jacobi.h"
+#include "multigrid.h"
 #include "cfdio.h"
+#include "checkpoint.h"
+#include "grid.h"
+
+
+//copies between the double and the float grids, which have different pitches
+static void narrow(float *out, cfdgrid gf, const double *in, cfdgrid g)
+{
+	for (int i=0;i<g.m+2;i++) {
+		for (int j=0;j<g.n+2;j++) {
+			out[i*gf.pitch+j]=(float)in[i*g.pitch+j];
+		}
+	}
+}
+
+static void widen(double *out, cfdgrid g, const float *in, cfdgrid gf)
+{
+	for (int i=0;i<g.m+2;i++) {
+		for (int j=0;j<g.n+2;j++) {
+			out[i*g.pitch+j]=(double)in[i*gf.pitch+j];
+		}
+	}
+}
 
 
 int main(int argc, char **argv)
@@ -15,12 +41,12 @@ int main(int argc, char **argv)
 	double tolerance=0.0; //tolerance for convergence. <=0 means do not check
 
 	//main arrays
-	double *psi;
+	double *psi, *zet = NULL;
 	//temporary versions of main arrays
-	double *psitmp;
+	double *psitmp, *zettmp = NULL;
 
-	//command line arguments
-	int scalefactor, numiter;
+	//command line arguments, the columns scale separately for a non-square grid
+	int scalefactor, nscalefactor, numiter;
 
 	//simulation sizes
 	int bbase=10;
@@ -30,25 +56,128 @@ int main(int argc, char **argv)
 	int nbase=32;
 
 	int irrotational = 1, checkerr = 0;
+	//Reynolds number of the rotational flow
+	double re = -1.0;
+
+	//red-black SOR instead of Jacobi, omega <= 0 picks the optimal one
+	int sor = 0;
+	double omega = 0.0;
+	//multigrid V-cycles instead of Jacobi, one cycle per iteration
+	multigrid *mg = NULL;
+	int usemg = 0;
+	//Jacobi on float grids, and for mixed only until the error reaches switchtol,
+	//then in double from the float result
+	float *psif = NULL, *psitmpf = NULL;
+	int usefloat = 0, mixed = 0;
+	const double switchtol = 1e-5;
 
 	int m,n,b,h,w;
+	//layout of the double and the float grids, and the region they all come from
+	cfdgrid grid, gridf;
+	gridarena *arena;
+	size_t arenasize;
 	int iter;
 	int i,j;
 
 	double tstart, tstop, ttot, titer;
 
-	//do we stop because of tolerance?
-	if (tolerance > 0) {checkerr=1;}
+	//CFD_SNAPSHOT=<file> writes psi and the velocity every printfreq iterations
+	const char *snapshotpath = getenv("CFD_SNAPSHOT");
+	SnapshotWriter *snapshots = NULL;
+
+	//CFD_CHECKPOINT=<file> saves the state every printfreq iterations, --restart <file>
+	//continues from it and keeps saving to it
+	const char *checkpointpath = getenv("CFD_CHECKPOINT");
+	Checkpoint *checkpoint = NULL;
+	int restart = argc > 1 && strcmp(argv[1], "--restart") == 0;
+	int firstiter = 1;
 
-	//check command line parameters and parse them
+	//check command line parameters and parse them, the checkpoint file replaces the scale
 
-	if (argc <3|| argc >4) {
-		printf("Usage: cfd <scale> <numiter>\n");
+	const int arg = restart ? 1 : 0;
+	if (argc < 3+arg || argc > 6+arg) {
+		printf("Usage: cfd <scale>[x<column scale>] <numiter> [tolerance] [jacobi|sor|mg|float|mixed|vort] [omega|re]\n");
+		printf("       cfd --restart <checkpoint> <numiter> [tolerance] [jacobi|sor|mg|float|mixed|vort] [omega|re]\n");
 		return 0;
 	}
 
-	scalefactor=atoi(argv[1]);
-	numiter=atoi(argv[2]);
+	if (restart) {
+		const double topen=gettime();
+		try {
+			checkpoint = new Checkpoint(argv[2]);
+		} catch (const std::exception& e) {
+			printf("%s\n", e.what());
+			return 0;
+		}
+		if (!checkpoint->is_valid()) {
+			printf("%s holds no saved state yet\n", argv[2]);
+			return 0;
+		}
+		printf("Mapped checkpoint %s in %g seconds\n", argv[2], gettime()-topen);
+		scalefactor=checkpoint->get_scalefactor();
+		nscalefactor=scalefactor;
+	}
+	else {
+		//e.g. 4x2 has twice the cells of scale 2 along i, the cells stay the same size
+		scalefactor=atoi(argv[1]);
+		const char *x=strchr(argv[1],'x');
+		nscalefactor=x != NULL ? atoi(x+1) : scalefactor;
+	}
+	numiter=atoi(argv[2+arg]);
+	if (numiter < 1) {
+		printf("Run at least one iteration\n");
+		return 0;
+	}
+	if (restart && numiter <= checkpoint->get_iteration()) {
+		printf("The checkpoint is after iteration %d already, ask for more iterations\n",checkpoint->get_iteration());
+		return 0;
+	}
+	if (argc > 3+arg) {
+		tolerance=atof(argv[3+arg]);
+	}
+	if (argc > 4+arg) {
+		if (strcmp(argv[4+arg], "sor") == 0) {
+			sor=1;
+		} else if (strcmp(argv[4+arg], "mg") == 0) {
+			usemg=1;
+		} else if (strcmp(argv[4+arg], "float") == 0) {
+			usefloat=1;
+		} else if (strcmp(argv[4+arg], "mixed") == 0) {
+			usefloat=1;
+			mixed=1;
+		} else if (strcmp(argv[4+arg], "vort") == 0) {
+			irrotational=0;
+		} else if (strcmp(argv[4+arg], "jacobi") != 0) {
+			printf("Unknown solver %s\n", argv[4+arg]);
+			return 0;
+		}
+	}
+	//the solver parameter, the relaxation factor or the Reynolds number
+	if (argc > 5+arg) {
+		if (irrotational) {
+			omega=atof(argv[5+arg]);
+		}
+		else {
+			re=atof(argv[5+arg]);
+		}
+	}
+	//a restart continues the flow it saved, with its Reynolds number
+	if (restart) {
+		if (checkpoint->has_vorticity() == (irrotational != 0)) {
+			printf("The checkpoint holds %s flow, use %s\n",
+				checkpoint->has_vorticity() ? "rotational" : "irrotational",
+				checkpoint->has_vorticity() ? "vort" : "another solver");
+			return 0;
+		}
+		re = checkpoint->get_re()*scalefactor;
+	}
+	if (!irrotational && re < 0.0) {
+		printf("Rotational flow needs a non-negative Reynolds number\n");
+		return 0;
+	}
+
+	//do we stop because of tolerance?
+	if (tolerance > 0) {checkerr=1;}
 
 	if(!checkerr) {
 		printf("Scale Factor = %i, iterations = %i\n",scalefactor, numiter);
@@ -57,56 +186,220 @@ int main(int argc, char **argv)
 		printf("Scale Factor = %i, iterations = %i, tolerance= %g\n",scalefactor,numiter,tolerance);
 	}
 
-	printf("Irrotational flow\n");
+	if (irrotational) {
+		printf("Irrotational flow\n");
+	}
+	else {
+		printf("Reynolds number = %g\n",re);
+	}
 
-	//Calculate b, h & w and m & n
+	//Calculate b, h & w and m & n, the inlet and the outlet keep their place and width
+	//when only the columns scale
 	b = bbase*scalefactor;
 	h = hbase*scalefactor;
 	w = wbase*scalefactor;
 	m = mbase*scalefactor;
-	n = nbase*scalefactor;
+	n = nbase*nscalefactor;
+	if (restart) {
+		m = checkpoint->get_m();
+		n = checkpoint->get_n();
+	}
+	if (h+w-1 > n) {
+		printf("The outlet doesn't fit into %d columns\n",n);
+		return 0;
+	}
+	grid = makegrid(m,n,sizeof(double));
+	gridf = makegrid(m,n,sizeof(float));
+
+	arenasize = 2*arenabytes(grid,sizeof(double));
+	if (!irrotational) arenasize += 2*arenabytes(grid,sizeof(double));
+	if (usefloat) arenasize += 2*arenabytes(gridf,sizeof(float));
+	if (usemg) arenasize += mgarenabytes(grid);
+	arena = arenacreate(arenasize);
+	if (arena == NULL) {
+		printf("Out of memory for the grids\n");
+		return 0;
+	}
 
-	printf("Running CFD on %d x %d grid in serial\n",m,n);
+	if (sor) {
+		if (omega <= 0.0 || omega >= 2.0) {
+			omega=soromega(m,n);
+		}
+		printf("Running CFD on %d x %d grid in serial, red-black SOR with omega = %g\n",m,n,omega);
+	}
+	else if (usemg) {
+		mg=mgcreate(grid,arena);
+		printf("Running CFD on %d x %d grid in serial, multigrid V-cycles on %d levels\n",m,n,mglevels(mg));
+	}
+	else if (usefloat) {
+		printf("Running CFD on %d x %d grid in serial, %s stencil in float%s\n",m,n,jacobikernel(),
+			mixed ? ", double below the switch error" : "");
+	}
+	else if (!irrotational) {
+		printf("Running CFD on %d x %d grid in serial, fused %s stencil for psi and zeta\n",m,n,jacobikernel());
+	}
+	else {
+		printf("Running CFD on %d x %d grid in serial, %s stencil\n",m,n,jacobikernel());
+	}
+
+	printf("Grids in one %.1f MB arena, huge pages: %s\n",arenacapacity(arena)/1048576.0,arenapages(arena));
 
-	//allocate arrays
-	psi    = (double *) malloc((m+2)*(n+2)*sizeof(double));
-	psitmp = (double *) malloc((m+2)*(n+2)*sizeof(double));
+	//allocate arrays, rows padded to whole cache lines
+	psi    = arenaalloc(arena,grid);
+	psitmp = arenaalloc(arena,grid);
+	if (!irrotational) {
+		zet    = arenaalloc(arena,grid);
+		zettmp = arenaalloc(arena,grid);
+		memset(zet,0,gridsize(grid)*sizeof(double));
+		memset(zettmp,0,gridsize(grid)*sizeof(double));
+	}
 
-	//zero the psi array
-	for (i=0;i<m+2;i++) {
-		for(j=0;j<n+2;j++) {
-			psi[i*(m+2)+j]=0.0;
+	if (restart) {
+		//the grids fault in from the mapping, boundaries and bnorm come with them
+		const double tload=gettime();
+		gridunpack(psi,checkpoint->get_psi(),grid);
+		memcpy(psitmp,psi,gridsize(grid)*sizeof(double));
+		if (!irrotational) {
+			gridunpack(zet,checkpoint->get_zet(),grid);
+			memcpy(zettmp,zet,gridsize(grid)*sizeof(double));
 		}
+		bnorm=checkpoint->get_bnorm();
+		re=checkpoint->get_re();
+		firstiter=checkpoint->get_iteration()+1;
+		printf("Restarting after iteration %d, loaded the state in %g seconds\n",firstiter-1,gettime()-tload);
 	}
+	else {
+		//zero the psi arrays, padding included
+		memset(psi,0,gridsize(grid)*sizeof(double));
+		memset(psitmp,0,gridsize(grid)*sizeof(double));
 
-	//set the psi boundary conditions
-	boundarypsi(psi,m,n,b,h,w);
+		//set the psi boundary conditions on both arrays once, they swap roles every iteration
+		boundarypsi(psi,grid,b,h,w);
+		boundarypsi(psitmp,grid,b,h,w);
 
-	//compute normalisation factor for error
-	bnorm=0.0;
+		if (!irrotational) {
+			//zeta boundary conditions
+			boundaryzet(zet,psi,grid);
 
-	for (i=0;i<m+2;i++) {
-			for (j=0;j<n+2;j++) {
-			bnorm += psi[i*(m+2)+j]*psi[i*(m+2)+j];
+			//the cells shrink as the grid grows, so does the cell Reynolds number
+			re = re / (double)scalefactor;
 		}
+
+		//compute normalisation factor for error
+		bnorm=0.0;
+
+		for (i=0;i<m+2;i++) {
+				for (j=0;j<n+2;j++) {
+				bnorm += psi[i*grid.pitch+j]*psi[i*grid.pitch+j];
+			}
+		}
+
+		if (!irrotational) {
+			for (i=0;i<m+2;i++) {
+				for (j=0;j<n+2;j++) {
+					bnorm += zet[i*grid.pitch+j]*zet[i*grid.pitch+j];
+				}
+			}
+		}
+		bnorm=sqrt(bnorm);
+	}
+
+	if (checkpointpath != NULL && checkpoint == NULL) {
+		try {
+			checkpoint = new Checkpoint(checkpointpath,m,n,scalefactor,!irrotational);
+		} catch (const std::exception& e) {
+			printf("%s\n", e.what());
+			return 0;
+		}
+	}
+	if (checkpoint != NULL) {
+		printf("Saving checkpoints every %d iterations\n",printfreq);
+	}
+
+	if (usefloat) {
+		psif    = arenaallocf(arena,gridf);
+		psitmpf = arenaallocf(arena,gridf);
+		narrow(psif,gridf,psi,grid);
+		narrow(psitmpf,gridf,psi,grid);
+	}
+
+	if (snapshotpath != NULL) {
+		try {
+			snapshots = new SnapshotWriter(snapshotpath,m,n);
+		} catch (const std::exception& e) {
+			printf("%s\n", e.what());
+			return 0;
+		}
+		printf("Writing snapshots to %s every %d iterations%s\n",snapshotpath,printfreq,
+			snapshots->is_direct_io() ? ", bypassing the page cache" : "");
 	}
-	bnorm=sqrt(bnorm);
 
 	//begin iterative Jacobi loop
 	printf("\nStarting main loop...\n\n");
+	//the loop runs at least once and computes the error on its last iteration
+	error=0.0;
 	tstart=gettime();
 
-	for(iter=1;iter<=numiter;iter++) {
+	for(iter=firstiter;iter<=numiter;iter++) {
+
+		if (sor) {
+			//update psi in place, the change is the error measure
+			error = sorstep(psi,grid,omega);
+
+			error=sqrt(error);
+			error=error/bnorm;
+		}
+		else if (usemg) {
+			//the error is the change one more Jacobi sweep would make, as for Jacobi
+			error = mgvcycle(mg,psi);
 
-		//calculate psi for next iteration
-		jacobistep(psitmp,psi,m,n);
-	
-		//calculate current error if required
-		if (checkerr || iter == numiter) {
-			error = deltasq(psitmp,psi,m,n);
+			error=sqrt(error);
+			error=error/bnorm;
+		}
+		else if (!irrotational) {
+			//psi and zeta in one pass, the residual of both comes with it
+			error = jacobistepvort(zettmp,psitmp,zet,psi,grid,re);
 
 			error=sqrt(error);
 			error=error/bnorm;
+
+			//the new zeta walls follow the new psi next to them
+			boundaryzet(zettmp,psitmp,grid);
+		}
+		else if (usefloat) {
+			//same as below on the float grids, the error is still summed in double
+			jacobistepf(psitmpf,psif,gridf);
+
+			if (checkerr || mixed || iter == numiter) {
+				error = deltasqf(psitmpf,psif,gridf);
+
+				error=sqrt(error);
+				error=error/bnorm;
+			}
+
+			float *swap=psif;
+			psif=psitmpf;
+			psitmpf=swap;
+
+			//refine in double from here on, float rounding would stall the error
+			if (mixed && error < switchtol && !(checkerr && error < tolerance)) {
+				printf("Switching to double on iteration %d, error = %g\n",iter,error);
+				widen(psi,grid,psif,gridf);
+				widen(psitmp,grid,psif,gridf);
+				usefloat=0;
+			}
+		}
+		else {
+			//calculate psi for next iteration
+			jacobistep(psitmp,psi,grid);
+
+			//calculate current error if required
+			if (checkerr || iter == numiter) {
+				error = deltasq(psitmp,psi,grid);
+
+				error=sqrt(error);
+				error=error/bnorm;
+			}
 		}
 
 		//quit early if we have reached required tolerance
@@ -117,10 +410,16 @@ int main(int argc, char **argv)
 			}
 		}
 
-		//copy back
-		for(i=1;i<=m;i++) {
-			for(j=1;j<=n;j++) {
-				psi[i*(m+2)+j]=psitmp[i*(m+2)+j];
+		//swap instead of copying back, the boundaries are the same in both arrays
+		if (!sor && !usemg && !usefloat) {
+			double *swap=psi;
+			psi=psitmp;
+			psitmp=swap;
+
+			if (!irrotational) {
+				swap=zet;
+				zet=zettmp;
+				zettmp=swap;
 			}
 		}
 
@@ -132,6 +431,20 @@ int main(int argc, char **argv)
 			else {
 				printf("Completed iteration %d, error = %g\n",iter,error);
 			}
+
+			//the writer thread does the rest while the loop goes on
+			if (snapshots != NULL) {
+				if (usefloat) snapshots->submit(psif,gridf.pitch,iter);
+				else snapshots->submit(psi,grid.pitch,iter);
+			}
+
+			//float runs save their grid widened into the spare double one
+			if (checkpoint != NULL) {
+				if (usefloat) {
+					widen(psitmp,grid,psif,gridf);
+				}
+				checkpoint->save(iter,bnorm,re,usefloat ? psitmp : psi,zet,grid.pitch);
+			}
 		}
 	}	// iter
 
@@ -139,22 +452,40 @@ int main(int argc, char **argv)
 
 	tstop=gettime();
 
+	//the float result is what gets written out
+	if (usefloat) {
+		widen(psi,grid,psif,gridf);
+	}
+
+	//a restarted run only did the iterations after the checkpoint
+	const int done = iter-firstiter+1 > 0 ? iter-firstiter+1 : 0;
 	ttot=tstop-tstart;
-	titer=ttot/(double)iter;
+	titer=done > 0 ? ttot/(double)done : 0.0;
 
 	//print out some stats
 	printf("\n... finished\n");
 	printf("After %d iterations, the error is %g\n",iter,error);
-	printf("Time for %d iterations was %g seconds\n",iter,ttot);
+	printf("Time for %d iterations was %g seconds\n",done,ttot);
 	printf("Each iteration took %g seconds\n",titer);
+	if (done > 0) {
+		printf("%g MLUP/s\n",(double)m*n/titer/1e6);
+	}
+	if (checkpoint != NULL) {
+		printf("Checkpoints took %g seconds, %.2f %% of the loop\n",checkpoint->get_seconds(),100.0*checkpoint->get_seconds()/ttot);
+		delete checkpoint;
+	}
 
-	//output results
-	//writedatafiles(psi,m,n, scalefactor);
-	//writeplotfile(m,n,scalefactor);
+	//output results, the final frame unless the loop just wrote it
+	if (snapshots != NULL) {
+		if (iter%printfreq != 0) snapshots->submit(psi,grid.pitch,iter);
+		printf("Wrote %d snapshots, the loop waited %g seconds for the writer\n",
+			snapshots->get_frames(),snapshots->get_stalled());
+		delete snapshots;
+	}
 
 	//free un-needed arrays
-	free(psi);
-	free(psitmp);
+	if (mg != NULL) mgfree(mg);
+	arenafree(arena);
 	printf("... finished\n");
 
 	return 0;
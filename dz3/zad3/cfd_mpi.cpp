@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <mpi.h>
+
+#include "boundary.h"
+#include "grid.h"
+
+// Rows of the grid are split into contiguous slabs, one per rank. Every slab is stored
+// as a rows x n grid, so the halo rows above and below it are its boundary rows; local
+// row l holds global row first - 1 + l.
+
+static constexpr int HALO_UP{0};
+static constexpr int HALO_DOWN{1};
+
+// One sweep over local rows [begin, end), returns the sum of the squared changes.
+static double sweeprows(double *psinew, const double *psi, int begin, int end, cfdgrid g)
+{
+	const int n{g.n}, stride{g.pitch};
+	double dsq{0.0};
+	for (int l=begin;l<end;l++) {
+		for (int j=1;j<=n;j++) {
+			const double v{0.25*(psi[(l-1)*stride+j]+psi[(l+1)*stride+j]+psi[l*stride+j-1]+psi[l*stride+j+1])};
+			const double d{v-psi[l*stride+j]};
+			psinew[l*stride+j]=v;
+			dsq+=d*d;
+		}
+	}
+	return dsq;
+}
+
+int main(int argc, char **argv)
+{
+	MPI_Init(&argc, &argv);
+
+	int rank, size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	int printfreq=1000; //output frequency
+	double tolerance=0.0; //tolerance for convergence. <=0 means do not check
+
+	//simulation sizes
+	int bbase=10;
+	int hbase=15;
+	int wbase=5;
+	int mbase=32;
+	int nbase=32;
+
+	if (argc < 3 || argc > 4) {
+		if (rank == 0) printf("Usage: cfd_mpi <scale> <numiter> [tolerance]\n");
+		MPI_Finalize();
+		return -1;
+	}
+
+	const int scalefactor{atoi(argv[1])};
+	const int numiter{atoi(argv[2])};
+	if (argc > 3) {
+		tolerance = atof(argv[3]);
+	}
+	const int checkerr{tolerance > 0};
+
+	//Calculate b, h & w and m & n
+	const int b = bbase*scalefactor;
+	const int h = hbase*scalefactor;
+	const int w = wbase*scalefactor;
+	const int m = mbase*scalefactor;
+	const int n = nbase*scalefactor;
+
+	if (size > m) {
+		if (rank == 0) printf("Can't split %d rows over %d ranks\n", m, size);
+		MPI_Finalize();
+		return -1;
+	}
+
+	//this rank's global interior rows
+	const int first{1 + (int)((long)m*rank/size)};
+	const int last{(int)((long)m*(rank+1)/size)};
+	const int rows{last-first+1};
+	//the slab has the pitch of the whole grid, the boundaries are set in that layout
+	const cfdgrid grid{makegrid(m,n,sizeof(double))};
+	const cfdgrid slab{makegrid(rows,n,sizeof(double))};
+	const int stride{slab.pitch};
+	const int up{rank > 0 ? rank-1 : MPI_PROC_NULL};
+	const int down{rank < size-1 ? rank+1 : MPI_PROC_NULL};
+
+	if (rank == 0) {
+		printf("Scale Factor = %i, iterations = %i, tolerance = %g\n",scalefactor,numiter,tolerance);
+		printf("Irrotational flow\n");
+		printf("Running CFD on %d x %d grid on %d ranks, %d to %d rows per rank\n",m,n,size,m/size,(m+size-1)/size);
+	}
+
+	//local slabs with halos, zeroed and with the boundary conditions of their rows
+	double *psi = gridalloc(slab);
+	double *psinew = gridalloc(slab);
+	if (psi == NULL || psinew == NULL) {
+		printf("Rank %d is out of memory for its slab\n", rank);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	memset(psi,0,gridsize(slab)*sizeof(double));
+	memset(psinew,0,gridsize(slab)*sizeof(double));
+	boundarypsi(psi,grid,b,h,w,first-1,last+1);
+	boundarypsi(psinew,grid,b,h,w,first-1,last+1);
+
+	//compute normalisation factor for error, the outer halos are the global boundary rows
+	double localnorm{0.0};
+	const int normbegin{rank == 0 ? 0 : 1};
+	const int normend{rank == size-1 ? rows+2 : rows+1};
+	for (int l=normbegin;l<normend;l++) {
+		for (int j=0;j<n+2;j++) {
+			localnorm += psi[l*stride+j]*psi[l*stride+j];
+		}
+	}
+	double bnorm;
+	MPI_Allreduce(&localnorm, &bnorm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	bnorm=sqrt(bnorm);
+
+	if (rank == 0) printf("\nStarting main loop...\n\n");
+	MPI_Barrier(MPI_COMM_WORLD);
+	const double tstart{MPI_Wtime()};
+
+	double error{0.0};
+	int iter;
+	for(iter=1;iter<=numiter;iter++) {
+		//exchange the halo rows in the background
+		MPI_Request requests[4];
+		MPI_Irecv(&psi[0], n+2, MPI_DOUBLE, up, HALO_DOWN, MPI_COMM_WORLD, &requests[0]);
+		MPI_Irecv(&psi[(rows+1)*stride], n+2, MPI_DOUBLE, down, HALO_UP, MPI_COMM_WORLD, &requests[1]);
+		MPI_Isend(&psi[1*stride], n+2, MPI_DOUBLE, up, HALO_UP, MPI_COMM_WORLD, &requests[2]);
+		MPI_Isend(&psi[rows*stride], n+2, MPI_DOUBLE, down, HALO_DOWN, MPI_COMM_WORLD, &requests[3]);
+
+		//rows that don't need the halos
+		double dsq{sweeprows(psinew,psi,2,rows,slab)};
+
+		//the first and the last row once the halos arrived
+		MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+		dsq += sweeprows(psinew,psi,1,2,slab);
+		if (rows > 1) {
+			dsq += sweeprows(psinew,psi,rows,rows+1,slab);
+		}
+
+		double *swap=psi;
+		psi=psinew;
+		psinew=swap;
+
+		//the global residual costs a collective, only compute it when needed
+		if (checkerr || iter == numiter || iter%printfreq == 0) {
+			double globaldsq;
+			MPI_Allreduce(&dsq, &globaldsq, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+			error=sqrt(globaldsq)/bnorm;
+		}
+
+		//quit early if we have reached required tolerance
+		if (checkerr && error < tolerance) {
+			if (rank == 0) printf("Converged on iteration %d\n",iter);
+			break;
+		}
+
+		//print loop information
+		if (rank == 0 && iter%printfreq == 0) {
+			printf("Completed iteration %d, error = %g\n",iter,error);
+		}
+	}
+
+	if (iter > numiter) iter=numiter;
+
+	const double ttot{MPI_Wtime()-tstart};
+	const double titer{ttot/(double)iter};
+
+	//print out some stats
+	if (rank == 0) {
+		printf("\n... finished\n");
+		printf("After %d iterations, the error is %g\n",iter,error);
+		printf("Time for %d iterations was %g seconds\n",iter,ttot);
+		printf("Each iteration took %g seconds\n",titer);
+		printf("%g MLUP/s in total, %g MLUP/s per rank\n",(double)m*n/titer/1e6,(double)m*n/titer/1e6/size);
+		printf("... finished\n");
+	}
+
+	gridfree(psi);
+	gridfree(psinew);
+
+	MPI_Finalize();
+	return 0;
+}
@@ -1,19 +1,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <memory>
 
 #include "arraymalloc.h"
 #include "boundary.h"
 #include "jacobi_opencl.hh"
+#include "profile.hh"
 #include "cfdio.h"
+#include "grid.h"
 
 
 int main(int argc, char **argv)
 {
 	int printfreq=1000; //output frequency
 	double error, bnorm;
+	double tolerance=0.0; //tolerance for convergence. <=0 means do not check
+	int checkfreq=100; //iterations between convergence checks
+	int checkerr=0;
+	//red-black SOR instead of Jacobi, omega <= 0 picks the optimal one
+	int sor=0;
+	double omega=0.0;
+	//Jacobi on float grids, and for mixed only until the error reaches switchtol,
+	//then in double from the float result
+	int usefloat=0, mixed=0;
+	const double switchtol=1e-5;
 
 	//command line arguments
 	int scalefactor, numiter;
@@ -26,31 +41,99 @@ int main(int argc, char **argv)
 	int nbase=32;
 
 	int irrotational = 1;
+	//Reynolds number of the rotational flow
+	double re = -1.0;
 
 	int m,n,b,h,w;
 	int iter;
 	int i,j;
 
 	double tstart, tstop, ttot, titer;
+	double tswitch = 0.0;
+
+	//CFD_SNAPSHOT=<file> writes psi and the velocity every printfreq iterations
+	const char *snapshotpath = getenv("CFD_SNAPSHOT");
+	std::unique_ptr<SnapshotWriter> snapshots;
+	//OPENCL_PROFILE=<file> profiles every command and writes a trace
+	Profiler profiler;
 
 	//check command line parameters and parse them
 
 	if (argc < 3) {
-		printf("Usage: cfd <scale> <numiter>\n");
+		printf("Usage: cfd <scale> <numiter> [batch_size] [tolerance] [check_every] [jacobi|sor|float|mixed|vort] [omega|re]\n");
 		return -1;
 	}
 
 	scalefactor=atoi(argv[1]);
 	numiter=atoi(argv[2]);
+	//the error comes from the last sweep and the rates are per iteration
+	if (numiter < 1) {
+		printf("Run at least one iteration\n");
+		return -1;
+	}
 
+	//iterations per kernel launch
 	int batch_size{1};
 	if (argc > 3) {
 		batch_size = atoi(argv[3]);
 	}
+	if (batch_size < 1) {
+		printf("The batch size must be at least 1\n");
+		return -1;
+	}
+	if (argc > 4) {
+		tolerance = atof(argv[4]);
+	}
+	if (argc > 5) {
+		checkfreq = atoi(argv[5]);
+	}
+	if (checkfreq < 1) {
+		printf("Convergence must be checked at least every iteration\n");
+		return -1;
+	}
+	if (argc > 6) {
+		if (strcmp(argv[6], "sor") == 0) {
+			sor = 1;
+		} else if (strcmp(argv[6], "float") == 0) {
+			usefloat = 1;
+		} else if (strcmp(argv[6], "mixed") == 0) {
+			usefloat = 1;
+			mixed = 1;
+		} else if (strcmp(argv[6], "vort") == 0) {
+			irrotational = 0;
+		} else if (strcmp(argv[6], "jacobi") != 0) {
+			printf("Unknown solver %s\n", argv[6]);
+			return -1;
+		}
+	}
+	//the solver parameter, the relaxation factor or the Reynolds number
+	if (argc > 7) {
+		if (irrotational) {
+			omega = atof(argv[7]);
+		} else {
+			re = atof(argv[7]);
+		}
+	}
+	if (!irrotational && re < 0.0) {
+		printf("Rotational flow needs a non-negative Reynolds number\n");
+		return -1;
+	}
 
-	printf("Scale Factor = %i, iterations = %i\n",scalefactor, numiter);
+	//do we stop because of tolerance?
+	if (tolerance > 0) {checkerr=1;}
 
-	printf("Irrotational flow\n");
+	if(!checkerr) {
+		printf("Scale Factor = %i, iterations = %i, batch size = %i\n",scalefactor, numiter, batch_size);
+	}
+	else {
+		printf("Scale Factor = %i, iterations = %i, batch size = %i, tolerance = %g, checked every %i iterations\n",scalefactor, numiter, batch_size, tolerance, checkfreq);
+	}
+
+	if (irrotational) {
+		printf("Irrotational flow\n");
+	} else {
+		printf("Reynolds number = %g\n", re);
+	}
 
 	//Calculate b, h & w and m & n
 	b = bbase*scalefactor;
@@ -61,60 +144,138 @@ int main(int argc, char **argv)
 
 	printf("Running CFD on %d x %d grid in serial\n",m,n);
 
-	//allocate arrays
-	std::vector<double> psi((m + 2) * (n + 2), 0.0);
-	std::vector<double> psitmp((m + 2) * (n + 2), 0.0);
+	//allocate arrays, with the row pitch of the device grids
+	const cfdgrid grid{makegrid(m, n, sizeof(double))};
+	std::vector<double> psi(gridsize(grid), 0.0);
+	std::vector<double> psitmp(gridsize(grid), 0.0);
 	
 	//set the psi boundary conditions
-	boundarypsi(psi.data(),m,n,b,h,w);
+	boundarypsi(psi.data(),grid,b,h,w);
+
+	//zeta boundary conditions, the cell Reynolds number shrinks with the cells
+	std::vector<double> zet;
+	if (!irrotational) {
+		zet.assign(gridsize(grid), 0.0);
+		boundaryzet(zet.data(),psi.data(),grid);
+		re = re / (double)scalefactor;
+	}
 
 	//compute normalisation factor for error
 	bnorm=0.0;
 
 	for (i=0;i<m+2;i++) {
 		for (j=0;j<n+2;j++) {
-			bnorm += psi[i*(m+2)+j]*psi[i*(m+2)+j];
+			bnorm += psi[i*grid.pitch+j]*psi[i*grid.pitch+j];
 		}
 	}
+	for (const double z : zet) {
+		bnorm += z*z;
+	}
 	bnorm=sqrt(bnorm);
 
 	Jacobi jacobi;
 	try {
-		jacobi = Jacobi(m, n, psitmp.data(), psi.data());
+		jacobi = Jacobi(grid, psi.data(), batch_size, usefloat, &profiler);
+		if (!irrotational) {
+			jacobi.vorticity(zet.data(), re);
+		}
 	} catch (std::exception e) {
 		std::cerr << "Error constructing the Jacobi object: " << e.what() << std::endl;
 		return -1;
 	}
+	if (sor) {
+		if (omega <= 0.0 || omega >= 2.0) {
+			omega = Jacobi::sor_omega(m, n);
+		}
+		printf("Red-black SOR with omega = %g, one iteration per launch pair\n", omega);
+	} else if (usefloat) {
+		printf("Grids in float%s\n", mixed ? ", double below the switch error" : "");
+	}
+	if (jacobi.is_zero_copy()) {
+		printf("Device grids used in place in a host arena\n");
+	}
+	if (!irrotational) {
+		printf("Fused psi and zeta steps, one per launch\n");
+	} else if (!sor && jacobi.get_batch_size() != batch_size) {
+		printf("Batch size limited to %d by the device local memory\n", jacobi.get_batch_size());
+	}
+
+	if (snapshotpath != NULL) {
+		try {
+			snapshots = std::make_unique<SnapshotWriter>(snapshotpath, m, n);
+		} catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return -1;
+		}
+		printf("Writing snapshots to %s every %d iterations%s\n", snapshotpath, printfreq,
+			snapshots->is_direct_io() ? ", bypassing the page cache" : "");
+	}
 
 	//begin iterative Jacobi loop
 	printf("\nStarting main loop...\n\n");
 	tstart=gettime();
 
-	for (iter = 1; iter <= numiter; iter++) {
-		//copy back
-		for(i=1;i<=m;i++) {
-			for(j=1;j<=n;j++) {
-				psi[i*(m+2)+j]=psitmp[i*(m+2)+j];
-			}
+	for (iter = 0; iter < numiter;) {
+		//run up to the next report or convergence check, the grids stay on the device
+		int next{std::min(numiter, (iter / printfreq + 1) * printfreq)};
+		if (checkerr) {
+			next = std::min(next, (iter / checkfreq + 1) * checkfreq);
+		}
+		if (sor) {
+			jacobi.sor(next - iter, omega);
+		} else if (!irrotational) {
+			jacobi.step_vort(next - iter);
+		} else {
+			jacobi.step(next - iter);
+		}
+		iter = next;
+
+		//the residual of the last sweep is reduced on the device, only the partial sums are read
+		const bool is_report{iter % printfreq == 0};
+		const bool is_switch_check{mixed && jacobi.is_single_precision()};
+		if (is_report || checkerr || is_switch_check) {
+			error = sqrt(jacobi.residual()) / bnorm;
+		}
+
+		//quit early if we have reached required tolerance
+		if (checkerr && error < tolerance) {
+			printf("Converged on iteration %d\n",iter);
+			break;
+		}
+
+		//refine in double from here on, float rounding would stall the error
+		if (is_switch_check && error < switchtol) {
+			printf("Switching to double on iteration %d, error = %g\n",iter,error);
+			jacobi.read(psi.data(), psitmp.data());
+			jacobi = Jacobi(grid, psi.data(), batch_size, false, &profiler);
+			//a new kernel on a new grid type, its launch may be tuned now; that isn't iterating
+			tswitch += jacobi.get_tuning_seconds();
 		}
 
-		//calculate psi for next iteration
-		jacobi.step();
-	
 		//print loop information
-		if(iter%printfreq == 0) {
-			printf("Completed iteration %d\n",iter);
+		if (is_report) {
+			printf("Completed iteration %d, error = %g\n",iter,error);
+		}
+
+		//the read waits for the device, the rest happens on the writer thread
+		if (is_report && snapshots) {
+			jacobi.read(psi.data(), psitmp.data());
+			snapshots->submit(psi.data(), grid.pitch, iter);
 		}
 	}
 
-	//calculate current error
-	error = sqrt(deltasq(psitmp,psi,m,n)) / bnorm;
+	//calculate current error and read the result back
+	error = sqrt(jacobi.residual()) / bnorm;
+	jacobi.read(psi.data(), psitmp.data());
+	if (!irrotational) {
+		jacobi.read_vorticity(zet.data());
+	}
 
 	if (iter > numiter) iter=numiter;
 
 	tstop=gettime();
 
-	ttot=tstop-tstart;
+	ttot=tstop-tstart-tswitch;
 	titer=ttot/(double)iter;
 
 	//print out some stats
@@ -122,6 +283,16 @@ int main(int argc, char **argv)
 	printf("After %d iterations, the error is %g\n",iter,error);
 	printf("Time for %d iterations was %g seconds\n",iter,ttot);
 	printf("Each iteration took %g seconds\n",titer);
+	if (tswitch > 0.0) {
+		printf("Tuning the double kernel after the switch took another %g seconds\n",tswitch);
+	}
+
+	if (snapshots) {
+		if (iter % printfreq != 0) snapshots->submit(psi.data(), grid.pitch, iter);
+		printf("Wrote %d snapshots, the loop waited %g seconds for the writer\n",
+			snapshots->get_frames(), snapshots->get_stalled());
+	}
+	profiler.report();
 
 	printf("... finished\n");
 
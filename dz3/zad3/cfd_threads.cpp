@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "jacobi_threads.hh"
+#include "cfdio.h"
+
+struct Run {
+	int iterations;
+	double error;
+	double seconds;
+};
+
+// Solves on the given number of threads and returns the iterations done, the final error and the loop time.
+Run solve(int threads, int m, int n, int b, int h, int w, int numiter, double tolerance, int printfreq)
+{
+	JacobiThreads jacobi(m, n, threads);
+	jacobi.boundary(b, h, w);
+
+	//compute normalisation factor for error
+	const double* psi{jacobi.grid()};
+	const int pitch{jacobi.row_pitch()};
+	double bnorm=0.0;
+	for (int i=0;i<m+2;i++) {
+		for (int j=0;j<n+2;j++) {
+			bnorm += psi[i*pitch+j]*psi[i*pitch+j];
+		}
+	}
+	bnorm=sqrt(bnorm);
+
+	const int checkerr{tolerance > 0};
+	Run run{0, 0.0, 0.0};
+	const double tstart{gettime()};
+	int iter;
+	for(iter=1;iter<=numiter;iter++) {
+		//sweep, residual and swap in one pass
+		run.error = sqrt(jacobi.step())/bnorm;
+
+		//quit early if we have reached required tolerance
+		if (checkerr && run.error < tolerance) {
+			if (printfreq > 0) printf("Converged on iteration %d\n",iter);
+			break;
+		}
+
+		//print loop information
+		if(printfreq > 0 && iter%printfreq == 0) {
+			printf("Completed iteration %d, error = %g\n",iter,run.error);
+		}
+	}
+	run.seconds = gettime() - tstart;
+	run.iterations = std::min(iter, numiter);
+	return run;
+}
+
+int main(int argc, char **argv)
+{
+	int printfreq=1000; //output frequency
+	double tolerance=0.0; //tolerance for convergence. <=0 means do not check
+
+	//simulation sizes
+	int bbase=10;
+	int hbase=15;
+	int wbase=5;
+	int mbase=32;
+	int nbase=32;
+
+	if (argc < 3 || argc > 5) {
+		printf("Usage: cfd_threads <scale> <numiter> [threads|scaling] [tolerance]\n");
+		return -1;
+	}
+
+	const int scalefactor{atoi(argv[1])};
+	const int numiter{atoi(argv[2])};
+	const int max_threads{static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))};
+	int threads{max_threads};
+	bool is_scaling{false};
+	if (argc > 3) {
+		if (strcmp(argv[3], "scaling") == 0) {
+			is_scaling = true;
+		} else {
+			threads = atoi(argv[3]);
+		}
+	}
+	//the rates below are per iteration
+	if (numiter < 1) {
+		printf("Run at least one iteration\n");
+		return -1;
+	}
+	if (threads < 1) {
+		printf("The number of threads must be at least 1\n");
+		return -1;
+	}
+	if (argc > 4) {
+		tolerance = atof(argv[4]);
+	}
+
+	//Calculate b, h & w and m & n
+	const int b = bbase*scalefactor;
+	const int h = hbase*scalefactor;
+	const int w = wbase*scalefactor;
+	const int m = mbase*scalefactor;
+	const int n = nbase*scalefactor;
+
+	printf("Scale Factor = %i, iterations = %i, tolerance = %g\n",scalefactor,numiter,tolerance);
+	printf("Irrotational flow\n");
+
+	if (!is_scaling) {
+		printf("Running CFD on %d x %d grid with %d threads\n",m,n,threads);
+		printf("\nStarting main loop...\n\n");
+		const Run run{solve(threads, m, n, b, h, w, numiter, tolerance, printfreq)};
+
+		//print out some stats
+		printf("\n... finished\n");
+		printf("After %d iterations, the error is %g\n",run.iterations,run.error);
+		printf("Time for %d iterations was %g seconds\n",run.iterations,run.seconds);
+		printf("Each iteration took %g seconds\n",run.seconds/run.iterations);
+		printf("%g MLUP/s\n",(double)m*n*run.iterations/run.seconds/1e6);
+		printf("... finished\n");
+		return 0;
+	}
+
+	//strong scaling: the same grid on 1, 2, 4, ... threads up to the hardware threads
+	std::vector<int> counts;
+	for (int t=1;t<max_threads;t*=2) counts.push_back(t);
+	counts.push_back(max_threads);
+
+	printf("Strong scaling on %d x %d grid, %d hardware threads\n\n",m,n,max_threads);
+	printf("| Threads | Iterations | Time (s) | MLUP/s | Speedup | Efficiency |\n");
+	printf("| ---:    | ---:       | ---:     | ---:   | ---:    | ---:       |\n");
+	double base{0.0};
+	for (const int t : counts) {
+		const Run run{solve(t, m, n, b, h, w, numiter, tolerance, 0)};
+		// Time per iteration, so tolerance runs that stop at different points stay comparable
+		const double per_iter{run.seconds/run.iterations};
+		if (t == 1) base = per_iter;
+		printf("| %d | %d | %.4f | %.1f | %.2f | %.0f %% |\n",
+			t, run.iterations, run.seconds, (double)m*n/per_iter/1e6, base/per_iter, 100.0*base/per_iter/t);
+	}
+
+	return 0;
+}
@@ -1,30 +1,226 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <math.h>
-
-#include "cfdio.h"
-#include "arraymalloc.h"
-
-#pragma warning(disable : 4996)
-
-
-// time in seconds
-#ifdef _WIN32 
-#include <windows.h>
-double gettime(void)
-{
-	LARGE_INTEGER fr, t;
-	QueryPerformanceFrequency(&fr);
-	QueryPerformanceCounter(&t);
-	double t_sec = (t.QuadPart) / (double)fr.QuadPart;
-	return t_sec;
-}
-#else 
-#include <sys/time.h>
-double gettime(void)
-{
-  struct timeval tp;
-  gettimeofday (&tp, NULL);
-  return tp.tv_sec + tp.tv_usec/(double)1.0e6;
-}
-#endif
\ No newline at end of file
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "cfdio.h"
+#include "arraymalloc.h"
+
+#pragma warning(disable : 4996)
+
+
+// time in seconds
+#ifdef _WIN32 
+#include <windows.h>
+double gettime(void)
+{
+	LARGE_INTEGER fr, t;
+	QueryPerformanceFrequency(&fr);
+	QueryPerformanceCounter(&t);
+	double t_sec = (t.QuadPart) / (double)fr.QuadPart;
+	return t_sec;
+}
+#else 
+#include <sys/time.h>
+double gettime(void)
+{
+  struct timeval tp;
+  gettimeofday (&tp, NULL);
+  return tp.tv_sec + tp.tv_usec/(double)1.0e6;
+}
+#endif
+
+
+// O_DIRECT wants the buffer, the offset and the length aligned to the block size
+static const size_t FRAMEALIGN=4096;
+static const size_t HEADERBYTES=64;
+// Frames from this size on bypass the page cache
+static const size_t DIRECTBYTES=4u<<20;
+
+SnapshotWriter::SnapshotWriter(const char* path, int mi, int ni): m{mi}, n{ni}
+{
+	const size_t payload = HEADERBYTES + ((size_t)(m+2)*(n+2) + 2*(size_t)m*n)*sizeof(float);
+	frame_bytes = (payload + FRAMEALIGN - 1) / FRAMEALIGN * FRAMEALIGN;
+	storage.reset(new char[frame_bytes + FRAMEALIGN]);
+	frame = storage.get() + (FRAMEALIGN - (uintptr_t)storage.get() % FRAMEALIGN) % FRAMEALIGN;
+	memset(frame, 0, frame_bytes);
+
+#ifdef _WIN32
+	fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+#ifdef O_DIRECT
+	if (frame_bytes >= DIRECTBYTES) {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		is_direct = fd >= 0;
+	}
+#endif
+	//some file systems, tmpfs for one, refuse O_DIRECT
+	if (fd < 0) {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+#endif
+	if (fd < 0) {
+		throw std::runtime_error(std::string("can't open snapshot file ") + path + ": " + strerror(errno));
+	}
+
+	for (Slot& slot : slots) {
+		slot.psi.resize((size_t)(m+2)*(n+2));
+	}
+	writer = std::thread(&SnapshotWriter::write_loop, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_stopping = true;
+	}
+	changed.notify_all();
+	writer.join();
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+template <typename T>
+void SnapshotWriter::submit_grid(const T* psi, int pitch, int iteration)
+{
+	const double start = gettime();
+	std::unique_lock<std::mutex> lock(mutex);
+	Slot& slot = slots[next_submit];
+	//both slots full means the writer is a whole frame behind
+	changed.wait(lock, [&slot] { return !slot.is_full; });
+	lock.unlock();
+	stalled += gettime() - start;
+
+	//the writer doesn't touch an empty slot, so the copy needs no lock
+	double *dense = slot.psi.data();
+	for (int i=0;i<m+2;i++) {
+		for (int j=0;j<n+2;j++) {
+			*dense++ = (double)psi[(size_t)i*pitch+j];
+		}
+	}
+	slot.iteration = iteration;
+
+	lock.lock();
+	slot.is_full = true;
+	next_submit = 1 - next_submit;
+	frames++;
+	lock.unlock();
+	changed.notify_all();
+}
+
+void SnapshotWriter::submit(const double* psi, int pitch, int iteration)
+{
+	submit_grid(psi, pitch, iteration);
+}
+
+void SnapshotWriter::submit(const float* psi, int pitch, int iteration)
+{
+	submit_grid(psi, pitch, iteration);
+}
+
+int SnapshotWriter::get_frames() const
+{
+	return frames;
+}
+
+double SnapshotWriter::get_stalled() const
+{
+	return stalled;
+}
+
+bool SnapshotWriter::is_direct_io() const
+{
+	return is_direct;
+}
+
+void SnapshotWriter::encode(const Slot& slot)
+{
+	//the slots are dense, row i starts at i*(n+2)
+	const double *psi = slot.psi.data();
+
+	memcpy(frame, "CFDSNAP1", 8);
+	const int32_t dims[4] = {m, n, slot.iteration, 0};
+	memcpy(frame + 8, dims, sizeof(dims));
+	const uint64_t bytes = frame_bytes;
+	memcpy(frame + 24, &bytes, sizeof(bytes));
+
+	float *out = (float *) (frame + HEADERBYTES);
+	for (int i=0;i<m+2;i++) {
+		for (int j=0;j<n+2;j++) {
+			*out++ = (float)psi[i*(n+2)+j];
+		}
+	}
+
+	//central differences, u = dpsi/dy and v = -dpsi/dx
+	float *u = out;
+	float *v = out + (size_t)m*n;
+	for (int i=1;i<=m;i++) {
+		for (int j=1;j<=n;j++) {
+			*u++ = (float)((psi[i*(n+2)+j+1]-psi[i*(n+2)+j-1])/2.0);
+			*v++ = (float)(-(psi[(i+1)*(n+2)+j]-psi[(i-1)*(n+2)+j])/2.0);
+		}
+	}
+}
+
+void SnapshotWriter::write_loop()
+{
+	bool is_failed = false;
+	while (true) {
+		std::unique_lock<std::mutex> lock(mutex);
+		Slot& slot = slots[next_write];
+		changed.wait(lock, [this, &slot] { return slot.is_full || is_stopping; });
+		if (!slot.is_full) return;
+		lock.unlock();
+
+		encode(slot);
+
+		//hand the slot back as soon as it is encoded, the write only needs the frame
+		lock.lock();
+		slot.is_full = false;
+		next_write = 1 - next_write;
+		lock.unlock();
+		changed.notify_all();
+
+		size_t done = 0;
+		while (!is_failed && done < frame_bytes) {
+#ifdef _WIN32
+			const long written = _write(fd, frame + done, (unsigned)(frame_bytes - done));
+#else
+			const ssize_t written = write(fd, frame + done, frame_bytes - done);
+#if defined(O_DIRECT) && defined(F_SETFL)
+			//a file system may accept O_DIRECT on open and only refuse it here
+			if (written < 0 && errno == EINVAL && is_direct) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+				is_direct = false;
+				continue;
+			}
+#endif
+#endif
+			if (written < 0) {
+				if (errno == EINTR) continue;
+				fprintf(stderr, "Snapshot write failed: %s, no more snapshots\n", strerror(errno));
+				is_failed = true;
+				break;
+			}
+			done += (size_t)written;
+		}
+	}
+}
@@ -1 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 double gettime(void);
+
+// Writes snapshots of psi and the velocity it implies to one binary file, in the
+// background. submit() only copies psi, with rows pitch elements apart, into one of
+// two slots; the writer thread
+// converts it and writes it while the solver keeps iterating, so the solver only
+// waits when it submits faster than the disk can take frames.
+//
+// Every frame starts on a 4 KiB boundary and is padded to a multiple of 4 KiB:
+//   64 byte header: char magic[8] = "CFDSNAP1", int32 m, n, iteration, 0,
+//                   uint64 frame bytes, zero padding
+//   float psi[m+2][n+2], boundaries included
+//   float u[m][n], v[m][n], the velocity in the interior, as in writedatafiles
+// Large frames bypass the page cache with O_DIRECT where the system has it.
+class SnapshotWriter {
+private:
+	struct Slot {
+		std::vector<double> psi;
+		int iteration{0};
+		bool is_full{false};
+	};
+
+	int m;
+	int n;
+	std::size_t frame_bytes;
+	int fd{-1};
+	std::atomic<bool> is_direct{false};
+	// Frame being written, aligned for O_DIRECT
+	std::unique_ptr<char[]> storage;
+	char* frame;
+
+	Slot slots[2];
+	// Slot the next submit fills and the writer takes next
+	int next_submit{0};
+	int next_write{0};
+	bool is_stopping{false};
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::thread writer;
+
+	int frames{0};
+	double stalled{0.0};
+
+	void write_loop();
+	void encode(const Slot& slot);
+	template <typename T>
+	void submit_grid(const T* psi, int pitch, int iteration);
+public:
+	SnapshotWriter(const char* path, int m, int n);
+	// Writes the pending frames and closes the file
+	~SnapshotWriter();
+	SnapshotWriter(const SnapshotWriter&) = delete;
+	SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+	void submit(const double* psi, int pitch, int iteration);
+	void submit(const float* psi, int pitch, int iteration);
+	int get_frames() const;
+	// Seconds the solver spent in submit waiting for a free slot
+	double get_stalled() const;
+	bool is_direct_io() const;
+};
@@ -0,0 +1,198 @@
+#include <string.h>
+#include <errno.h>
+
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "checkpoint.h"
+#include "cfdio.h"
+#include "grid.h"
+
+static const char MAGIC[8] = {'C', 'F', 'D', 'C', 'K', 'P', 'T', '1'};
+// The header takes a page of its own, the slots start on page boundaries
+static const std::size_t PAGE = 4096;
+
+static std::size_t slotsize(int m, int n, bool has_zet)
+{
+	const std::size_t grid = static_cast<std::size_t>(m + 2) * (n + 2) * sizeof(double);
+	return ((has_zet ? 2 : 1) * grid + PAGE - 1) / PAGE * PAGE;
+}
+
+static std::runtime_error failure(const char* what, const char* path)
+{
+	return std::runtime_error(std::string(what) + " " + path + ": " + strerror(errno));
+}
+
+#ifdef _WIN32
+
+Checkpoint::Checkpoint(const char*, int, int, int, bool)
+{
+	throw std::runtime_error("checkpoints need mmap");
+}
+
+Checkpoint::Checkpoint(const char*)
+{
+	throw std::runtime_error("checkpoints need mmap");
+}
+
+Checkpoint::~Checkpoint() {}
+
+void Checkpoint::open_map(const char*, bool) {}
+
+void Checkpoint::save(int, double, double, const double*, const double*, int) {}
+
+#else
+
+void Checkpoint::open_map(const char* path, bool is_new)
+{
+	if (is_new && ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+		throw failure("can't size checkpoint", path);
+	}
+	void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED) {
+		throw failure("can't map checkpoint", path);
+	}
+	map = static_cast<char*>(address);
+	header = reinterpret_cast<Header*>(map);
+}
+
+Checkpoint::Checkpoint(const char* path, int m, int n, int scalefactor, bool has_zet)
+{
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw failure("can't create checkpoint", path);
+	}
+	slot_bytes = slotsize(m, n, has_zet);
+	bytes = PAGE + 2 * slot_bytes;
+	open_map(path, true);
+
+	memcpy(header->magic, MAGIC, sizeof(MAGIC));
+	header->m = m;
+	header->n = n;
+	header->scalefactor = scalefactor;
+	header->has_zet = has_zet;
+	header->valid = -1;
+	msync(map, PAGE, MS_SYNC);
+}
+
+Checkpoint::Checkpoint(const char* path)
+{
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		throw failure("can't open checkpoint", path);
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < PAGE) {
+		close(fd);
+		throw std::runtime_error(std::string(path) + " is not a checkpoint");
+	}
+	bytes = static_cast<std::size_t>(info.st_size);
+	open_map(path, false);
+
+	// Only the header is touched here, the grids fault in when they are read
+	slot_bytes = slotsize(header->m, header->n, header->has_zet);
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || bytes != PAGE + 2 * slot_bytes) {
+		munmap(map, bytes);
+		close(fd);
+		throw std::runtime_error(std::string(path) + " is not a checkpoint");
+	}
+}
+
+Checkpoint::~Checkpoint()
+{
+	munmap(map, bytes);
+	close(fd);
+}
+
+void Checkpoint::save(int iteration, double bnorm, double re, const double* psi, const double* zet, int pitch)
+{
+	const double start = gettime();
+	const int slot = header->valid == 0 ? 1 : 0;
+	const std::size_t grid = static_cast<std::size_t>(header->m + 2) * (header->n + 2);
+
+	double* out = slot_psi(slot);
+	const cfdgrid layout{header->m, header->n, pitch};
+	gridpack(out, psi, layout);
+	if (header->has_zet) {
+		gridpack(out + grid, zet, layout);
+	}
+	header->slots[slot].iteration = iteration;
+	header->slots[slot].bnorm = bnorm;
+	header->slots[slot].re = re;
+	msync(out, slot_bytes, MS_SYNC);
+	msync(map, PAGE, MS_SYNC);
+
+	// The slot is on disk, now it may become the valid one
+	header->valid = slot;
+	msync(map, PAGE, MS_SYNC);
+	seconds += gettime() - start;
+}
+
+#endif
+
+double* Checkpoint::slot_psi(int slot) const
+{
+	return reinterpret_cast<double*>(map + PAGE + slot * slot_bytes);
+}
+
+bool Checkpoint::is_valid() const
+{
+	return header->valid == 0 || header->valid == 1;
+}
+
+int Checkpoint::get_m() const
+{
+	return header->m;
+}
+
+int Checkpoint::get_n() const
+{
+	return header->n;
+}
+
+int Checkpoint::get_scalefactor() const
+{
+	return header->scalefactor;
+}
+
+bool Checkpoint::has_vorticity() const
+{
+	return header->has_zet != 0;
+}
+
+int Checkpoint::get_iteration() const
+{
+	return static_cast<int>(header->slots[header->valid].iteration);
+}
+
+double Checkpoint::get_bnorm() const
+{
+	return header->slots[header->valid].bnorm;
+}
+
+double Checkpoint::get_re() const
+{
+	return header->slots[header->valid].re;
+}
+
+const double* Checkpoint::get_psi() const
+{
+	return slot_psi(header->valid);
+}
+
+const double* Checkpoint::get_zet() const
+{
+	return header->has_zet ? slot_psi(header->valid) + static_cast<std::size_t>(header->m + 2) * (header->n + 2) : nullptr;
+}
+
+double Checkpoint::get_seconds() const
+{
+	return seconds;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Solver state in a memory-mapped file: a header page and two slots, each with psi and,
+// for rotational flow, zeta. save() fills the slot that isn't the valid one, syncs it and
+// only then marks it valid, so a run killed in the middle of a checkpoint still leaves
+// the previous one intact.
+class Checkpoint {
+private:
+	struct SlotInfo {
+		int64_t iteration;
+		double bnorm;
+		double re;
+	};
+	struct Header {
+		char magic[8];
+		int32_t m, n;
+		int32_t scalefactor;
+		int32_t has_zet;
+		// -1 until the first save
+		int32_t valid;
+		int32_t padding;
+		SlotInfo slots[2];
+	};
+
+	int fd{-1};
+	std::size_t bytes{0};
+	std::size_t slot_bytes{0};
+	char* map{nullptr};
+	Header* header{nullptr};
+	double seconds{0.0};
+
+	double* slot_psi(int slot) const;
+	void open_map(const char* path, bool is_new);
+public:
+	// Creates or truncates path for a run on an m x n grid
+	Checkpoint(const char* path, int m, int n, int scalefactor, bool has_zet);
+	// Maps an existing checkpoint to restart from it
+	explicit Checkpoint(const char* path);
+	~Checkpoint();
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	// Writes the state after the given iteration, zet is ignored for irrotational flow.
+	// The rows of psi and zet are pitch elements apart, the file stores them dense.
+	void save(int iteration, double bnorm, double re, const double* psi, const double* zet, int pitch);
+
+	bool is_valid() const;
+	int get_m() const;
+	int get_n() const;
+	int get_scalefactor() const;
+	bool has_vorticity() const;
+	// State of the last save; the grids are dense (m+2) x (n+2), point into the mapping
+	// and stay valid until the next save
+	int get_iteration() const;
+	double get_bnorm() const;
+	double get_re() const;
+	const double* get_psi() const;
+	const double* get_zet() const;
+	// Seconds spent in save so far
+	double get_seconds() const;
+};
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+static const size_t HUGEPAGE=2u<<20;
+
+struct gridarena {
+	char *base;
+	size_t capacity;
+	size_t used;
+	const char *pages;
+};
+
+
+cfdgrid makegrid(int m, int n, size_t elemsize)
+{
+	const int line = (int)(CACHELINE/elemsize);
+	cfdgrid g;
+	g.m = m;
+	g.n = n;
+	g.pitch = (n+2+line-1)/line*line;
+	return g;
+}
+
+
+size_t gridsize(cfdgrid g)
+{
+	return (size_t)(g.m+2)*g.pitch;
+}
+
+
+// The allocation starts on a cache line, the array one element before the next line, so
+// that (0, 1) and with it (i, 1) of every row is aligned
+static void *allocate(cfdgrid g, size_t elemsize)
+{
+	const size_t bytes = CACHELINE+gridsize(g)*elemsize;
+#ifdef _WIN32
+	void *block = _aligned_malloc(bytes, CACHELINE);
+	if (block == NULL) return NULL;
+#else
+	void *block = NULL;
+	if (posix_memalign(&block, CACHELINE, bytes) != 0) return NULL;
+#endif
+	return (char *)block+CACHELINE-elemsize;
+}
+
+
+double *gridalloc(cfdgrid g)
+{
+	return (double *)allocate(g, sizeof(double));
+}
+
+
+float *gridallocf(cfdgrid g)
+{
+	return (float *)allocate(g, sizeof(float));
+}
+
+
+static void release(void *a, size_t elemsize)
+{
+	if (a == NULL) return;
+#ifdef _WIN32
+	_aligned_free((char *)a-(CACHELINE-elemsize));
+#else
+	free((char *)a-(CACHELINE-elemsize));
+#endif
+}
+
+
+void gridfree(double *a)
+{
+	release(a, sizeof(double));
+}
+
+
+void gridfreef(float *a)
+{
+	release(a, sizeof(float));
+}
+
+
+static size_t roundup(size_t bytes, size_t align)
+{
+	return (bytes+align-1)/align*align;
+}
+
+
+gridarena *arenacreate(size_t bytes)
+{
+	gridarena *arena = (gridarena *)calloc(1, sizeof(gridarena));
+	if (arena == NULL) return NULL;
+	arena->capacity = roundup(bytes > 0 ? bytes : 1, HUGEPAGE);
+	arena->pages = "none";
+	const char *env = getenv("CFD_HUGEPAGES");
+	const int huge = env == NULL || strcmp(env, "0") != 0;
+
+#ifdef __linux__
+	void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	//fails right away unless enough pages are reserved in /proc/sys/vm/nr_hugepages
+	if (huge) {
+		p = mmap(NULL, arena->capacity, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) arena->pages = "explicit";
+	}
+#endif
+	if (p == MAP_FAILED) {
+		//transparent huge pages need 2 MB aligned addresses, so map one page more and
+		//give back what sticks out on either side
+		const size_t mapped = arena->capacity+HUGEPAGE;
+		p = mmap(NULL, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			free(arena);
+			return NULL;
+		}
+		char *start = (char *)roundup((size_t)p, HUGEPAGE);
+		const size_t head = start-(char *)p;
+		if (head > 0) munmap(p, head);
+		munmap(start+arena->capacity, HUGEPAGE-head);
+		p = start;
+#ifdef MADV_HUGEPAGE
+		if (huge && madvise(p, arena->capacity, MADV_HUGEPAGE) == 0) arena->pages = "transparent";
+#endif
+	}
+	arena->base = (char *)p;
+#else
+	(void)huge;
+#ifdef _WIN32
+	arena->base = (char *)_aligned_malloc(arena->capacity, HUGEPAGE);
+#else
+	void *block = NULL;
+	arena->base = posix_memalign(&block, HUGEPAGE, arena->capacity) == 0 ? (char *)block : NULL;
+#endif
+	if (arena->base == NULL) {
+		free(arena);
+		return NULL;
+	}
+#endif
+	return arena;
+}
+
+
+void arenafree(gridarena *arena)
+{
+	if (arena == NULL) return;
+#ifdef __linux__
+	munmap(arena->base, arena->capacity);
+#elif defined(_WIN32)
+	_aligned_free(arena->base);
+#else
+	free(arena->base);
+#endif
+	free(arena);
+}
+
+
+static void *bump(gridarena *arena, size_t bytes, size_t align)
+{
+	const size_t start = roundup(arena->used, align);
+	if (start > arena->capacity || bytes > arena->capacity-start) return NULL;
+	arena->used = start+bytes;
+	return arena->base+start;
+}
+
+
+size_t arenabytes(cfdgrid g, size_t elemsize)
+{
+	return CACHELINE+roundup(gridsize(g)*elemsize, CACHELINE);
+}
+
+
+double *arenaalloc(gridarena *arena, cfdgrid g)
+{
+	char *block = (char *)bump(arena, arenabytes(g, sizeof(double)), CACHELINE);
+	return block == NULL ? NULL : (double *)(block+CACHELINE-sizeof(double));
+}
+
+
+float *arenaallocf(gridarena *arena, cfdgrid g)
+{
+	char *block = (char *)bump(arena, arenabytes(g, sizeof(float)), CACHELINE);
+	return block == NULL ? NULL : (float *)(block+CACHELINE-sizeof(float));
+}
+
+
+void *arenaallochost(gridarena *arena, size_t bytes, size_t align)
+{
+	return bump(arena, roundup(bytes, CACHELINE), align > CACHELINE ? align : CACHELINE);
+}
+
+
+const char *arenapages(const gridarena *arena)
+{
+	return arena->pages;
+}
+
+
+size_t arenacapacity(const gridarena *arena)
+{
+	return arena->capacity;
+}
+
+
+void gridpack(double *dense, const double *a, cfdgrid g)
+{
+	for (int i=0;i<g.m+2;i++) {
+		memcpy(dense+(size_t)i*(g.n+2), a+(size_t)i*g.pitch, (g.n+2)*sizeof(double));
+	}
+}
+
+
+void gridunpack(double *a, const double *dense, cfdgrid g)
+{
+	for (int i=0;i<g.m+2;i++) {
+		memcpy(a+(size_t)i*g.pitch, dense+(size_t)i*(g.n+2), (g.n+2)*sizeof(double));
+	}
+}
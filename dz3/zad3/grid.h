@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+
+// Bytes per cache line, also the widest vector (AVX-512)
+static const size_t CACHELINE=64;
+
+// Layout of an (m+2) x (n+2) array with its boundaries. Row i starts pitch elements after
+// row i-1, point (i, j) is a[i*pitch+j]. The pitch is n+2 rounded up to whole cache
+// lines, and gridalloc places the first interior column (i, 1) of every row on a cache
+// line boundary, so vector sweeps over j = 1..n load and store whole lines.
+struct cfdgrid {
+	int m;
+	int n;
+	int pitch;
+};
+
+// Layout for elements of the given size, e.g. sizeof(double)
+cfdgrid makegrid(int m, int n, size_t elemsize);
+
+// Elements of one array, (m+2)*pitch
+size_t gridsize(cfdgrid g);
+
+// Uninitialised arrays for the layout, NULL if out of memory. Free them with gridfree
+// and gridfreef; the pointer isn't the start of the allocation.
+double *gridalloc(cfdgrid g);
+float *gridallocf(cfdgrid g);
+void gridfree(double *a);
+void gridfreef(float *a);
+
+// Bump allocator that places all the grids of a run in one region. The region starts on
+// a 2 MB boundary and is backed by 2 MB pages where the system has them: explicit huge
+// pages if some are reserved, otherwise transparent ones on request. CFD_HUGEPAGES=0
+// keeps it on normal pages. Nothing is freed before arenafree.
+struct gridarena;
+
+// An arena of at least the given size, NULL if there isn't that much address space
+gridarena *arenacreate(size_t bytes);
+void arenafree(gridarena *arena);
+
+// Bytes arenaalloc takes for one array, to size the arena with
+size_t arenabytes(cfdgrid g, size_t elemsize);
+
+// Arrays laid out as by gridalloc, NULL once the arena is full. The memory of a fresh
+// arena is only touched when it is first written, so first touch still places it.
+double *arenaalloc(gridarena *arena, cfdgrid g);
+float *arenaallocf(gridarena *arena, cfdgrid g);
+
+// Block that starts on a multiple of align (a power of two) and takes whole cache lines,
+// as CL_MEM_USE_HOST_PTR needs for zero-copy buffers. Needs up to bytes+align of the arena.
+void *arenaallochost(gridarena *arena, size_t bytes, size_t align);
+
+// "explicit", "transparent" or "none"
+const char *arenapages(const gridarena *arena);
+size_t arenacapacity(const gridarena *arena);
+
+// Copies between a padded array and a dense (m+2) x (n+2) one, for file formats and
+// host buffers that don't know the pitch
+void gridpack(double *dense, const double *a, cfdgrid g);
+void gridunpack(double *a, const double *dense, cfdgrid g);
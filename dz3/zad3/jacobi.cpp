@@ -1,22 +1,316 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include "jacobi.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JACOBI_X86_SIMD
+#include <immintrin.h>
+//GCC treats the intrinsics as plain vector arithmetic and would fuse a*b+c into an
+//FMA wherever the target has one, AVX-512 always does. Clang only fuses within one
+//expression and has no such attribute.
+#ifdef __clang__
+#define JACOBI_TARGET(isa) __attribute__((target(isa)))
+#else
+#define JACOBI_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#endif
+#endif
 
-void jacobistep(double *psinew, double *psi, int m, int n)
+
+static void jacobistep_scalar(double *psinew, double *psi, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	int i, j;
+
+	for(i=1;i<=m;i++) {
+		for(j=1;j<=n;j++) {
+		psinew[i*p+j]=0.25*(psi[(i-1)*p+j]+psi[(i+1)*p+j]+psi[i*p+j-1]+psi[i*p+j+1]);
+		}
+	}
+}
+
+static void jacobistepf_scalar(float *psinew, float *psi, cfdgrid g)
 {
+	const int m=g.m, n=g.n, p=g.pitch;
 	int i, j;
-  
+
 	for(i=1;i<=m;i++) {
 		for(j=1;j<=n;j++) {
-		psinew[i*(m+2)+j]=0.25*(psi[(i-1)*(m+2)+j]+psi[(i+1)*(m+2)+j]+psi[i*(m+2)+j-1]+psi[i*(m+2)+j+1]);
+		psinew[i*p+j]=0.25f*(psi[(i-1)*p+j]+psi[(i+1)*p+j]+psi[i*p+j-1]+psi[i*p+j+1]);
+		}
+	}
+}
+
+// One point of the stream function/vorticity step, returns its squared changes
+static inline double vortpoint(double *zetnew, double *psinew, const double *zet, const double *psi, int i, int j, int p, double re)
+{
+	const int k=i*p+j;
+	psinew[k]=0.25*(psi[k-p]+psi[k+p]+psi[k-1]+psi[k+1]-zet[k]);
+	zetnew[k]=0.25*(zet[k-p]+zet[k+p]+zet[k-1]+zet[k+1])
+		-re/16.0*((psi[k+1]-psi[k-1])*(zet[k+p]-zet[k-p])
+			-(psi[k+p]-psi[k-p])*(zet[k+1]-zet[k-1]));
+	const double dpsi=psinew[k]-psi[k];
+	const double dzet=zetnew[k]-zet[k];
+	return dpsi*dpsi+dzet*dzet;
+}
+
+static double jacobistepvort_scalar(double *zetnew, double *psinew, double *zet, double *psi, cfdgrid g, double re)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	double dsq=0.0;
+	for(int i=1;i<=m;i++) {
+		for(int j=1;j<=n;j++) {
+			dsq+=vortpoint(zetnew,psinew,zet,psi,i,j,p,re);
+		}
+	}
+	return dsq;
+}
+
+#ifdef JACOBI_X86_SIMD
+
+// The vector kernels add in the same order as the scalar one and don't use FMA,
+// so all three produce the same bits. Column 1 of every row is on a cache line, so
+// only the loads shifted by one column can be unaligned.
+
+JACOBI_TARGET("avx2")
+static void jacobistep_avx2(double *psinew, double *psi, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	const __m256d quarter = _mm256_set1_pd(0.25);
+	for(int i=1;i<=m;i++) {
+		const double *up = psi+(i-1)*p;
+		const double *row = psi+i*p;
+		const double *down = psi+(i+1)*p;
+		double *out = psinew+i*p;
+		int j=1;
+		for(;j+3<=n;j+=4) {
+			__m256d sum = _mm256_add_pd(_mm256_load_pd(up+j), _mm256_load_pd(down+j));
+			sum = _mm256_add_pd(sum, _mm256_loadu_pd(row+j-1));
+			sum = _mm256_add_pd(sum, _mm256_loadu_pd(row+j+1));
+			_mm256_store_pd(out+j, _mm256_mul_pd(quarter, sum));
+		}
+		for(;j<=n;j++) {
+			out[j]=0.25*(up[j]+down[j]+row[j-1]+row[j+1]);
+		}
+	}
+}
+
+JACOBI_TARGET("avx512f")
+static void jacobistep_avx512(double *psinew, double *psi, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	const __m512d quarter = _mm512_set1_pd(0.25);
+	for(int i=1;i<=m;i++) {
+		const double *up = psi+(i-1)*p;
+		const double *row = psi+i*p;
+		const double *down = psi+(i+1)*p;
+		double *out = psinew+i*p;
+		int j=1;
+		for(;j+7<=n;j+=8) {
+			__m512d sum = _mm512_add_pd(_mm512_load_pd(up+j), _mm512_load_pd(down+j));
+			sum = _mm512_add_pd(sum, _mm512_loadu_pd(row+j-1));
+			sum = _mm512_add_pd(sum, _mm512_loadu_pd(row+j+1));
+			_mm512_store_pd(out+j, _mm512_mul_pd(quarter, sum));
+		}
+		for(;j<=n;j++) {
+			out[j]=0.25*(up[j]+down[j]+row[j-1]+row[j+1]);
+		}
+	}
+}
+
+JACOBI_TARGET("avx2")
+static void jacobistepf_avx2(float *psinew, float *psi, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	for(int i=1;i<=m;i++) {
+		const float *up = psi+(i-1)*p;
+		const float *row = psi+i*p;
+		const float *down = psi+(i+1)*p;
+		float *out = psinew+i*p;
+		int j=1;
+		for(;j+7<=n;j+=8) {
+			__m256 sum = _mm256_add_ps(_mm256_load_ps(up+j), _mm256_load_ps(down+j));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(row+j-1));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(row+j+1));
+			_mm256_store_ps(out+j, _mm256_mul_ps(quarter, sum));
+		}
+		for(;j<=n;j++) {
+			out[j]=0.25f*(up[j]+down[j]+row[j-1]+row[j+1]);
+		}
+	}
+}
+
+JACOBI_TARGET("avx512f")
+static void jacobistepf_avx512(float *psinew, float *psi, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	const __m512 quarter = _mm512_set1_ps(0.25f);
+	for(int i=1;i<=m;i++) {
+		const float *up = psi+(i-1)*p;
+		const float *row = psi+i*p;
+		const float *down = psi+(i+1)*p;
+		float *out = psinew+i*p;
+		int j=1;
+		for(;j+15<=n;j+=16) {
+			__m512 sum = _mm512_add_ps(_mm512_load_ps(up+j), _mm512_load_ps(down+j));
+			sum = _mm512_add_ps(sum, _mm512_loadu_ps(row+j-1));
+			sum = _mm512_add_ps(sum, _mm512_loadu_ps(row+j+1));
+			_mm512_store_ps(out+j, _mm512_mul_ps(quarter, sum));
+		}
+		for(;j<=n;j++) {
+			out[j]=0.25f*(up[j]+down[j]+row[j-1]+row[j+1]);
+		}
+	}
+}
+
+// The fused vorticity kernels keep one partial sum per lane, so their residual is
+// summed in a different order than the scalar one.
+
+JACOBI_TARGET("avx2")
+static double jacobistepvort_avx2(double *zetnew, double *psinew, double *zet, double *psi, cfdgrid g, double re)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	const __m256d quarter = _mm256_set1_pd(0.25);
+	const __m256d re16 = _mm256_set1_pd(re/16.0);
+	__m256d acc = _mm256_setzero_pd();
+	double dsq=0.0;
+	for(int i=1;i<=m;i++) {
+		const double *pu = psi+(i-1)*p, *pr = psi+i*p, *pd = psi+(i+1)*p;
+		const double *zu = zet+(i-1)*p, *z = zet+i*p, *zd = zet+(i+1)*p;
+		int j=1;
+		for(;j+3<=n;j+=4) {
+			const __m256d pc = _mm256_load_pd(pr+j), zc = _mm256_load_pd(z+j);
+			const __m256d pn = _mm256_load_pd(pu+j), ps = _mm256_load_pd(pd+j);
+			const __m256d pw = _mm256_loadu_pd(pr+j-1), pe = _mm256_loadu_pd(pr+j+1);
+			const __m256d zn = _mm256_load_pd(zu+j), zs = _mm256_load_pd(zd+j);
+			const __m256d zw = _mm256_loadu_pd(z+j-1), ze = _mm256_loadu_pd(z+j+1);
+			__m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(pn, ps), pw), pe);
+			const __m256d pnew = _mm256_mul_pd(quarter, _mm256_sub_pd(sum, zc));
+			sum = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(zn, zs), zw), ze);
+			const __m256d adv = _mm256_sub_pd(_mm256_mul_pd(_mm256_sub_pd(pe, pw), _mm256_sub_pd(zs, zn)),
+				_mm256_mul_pd(_mm256_sub_pd(ps, pn), _mm256_sub_pd(ze, zw)));
+			const __m256d znew = _mm256_sub_pd(_mm256_mul_pd(quarter, sum), _mm256_mul_pd(re16, adv));
+			_mm256_store_pd(psinew+i*p+j, pnew);
+			_mm256_store_pd(zetnew+i*p+j, znew);
+			const __m256d dp = _mm256_sub_pd(pnew, pc), dz = _mm256_sub_pd(znew, zc);
+			acc = _mm256_add_pd(acc, _mm256_add_pd(_mm256_mul_pd(dp, dp), _mm256_mul_pd(dz, dz)));
+		}
+		for(;j<=n;j++) {
+			dsq+=vortpoint(zetnew,psinew,zet,psi,i,j,p,re);
+		}
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	return dsq+lanes[0]+lanes[1]+lanes[2]+lanes[3];
+}
+
+JACOBI_TARGET("avx512f")
+static double jacobistepvort_avx512(double *zetnew, double *psinew, double *zet, double *psi, cfdgrid g, double re)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	const __m512d quarter = _mm512_set1_pd(0.25);
+	const __m512d re16 = _mm512_set1_pd(re/16.0);
+	__m512d acc = _mm512_setzero_pd();
+	double dsq=0.0;
+	for(int i=1;i<=m;i++) {
+		const double *pu = psi+(i-1)*p, *pr = psi+i*p, *pd = psi+(i+1)*p;
+		const double *zu = zet+(i-1)*p, *z = zet+i*p, *zd = zet+(i+1)*p;
+		int j=1;
+		for(;j+7<=n;j+=8) {
+			const __m512d pc = _mm512_load_pd(pr+j), zc = _mm512_load_pd(z+j);
+			const __m512d pn = _mm512_load_pd(pu+j), ps = _mm512_load_pd(pd+j);
+			const __m512d pw = _mm512_loadu_pd(pr+j-1), pe = _mm512_loadu_pd(pr+j+1);
+			const __m512d zn = _mm512_load_pd(zu+j), zs = _mm512_load_pd(zd+j);
+			const __m512d zw = _mm512_loadu_pd(z+j-1), ze = _mm512_loadu_pd(z+j+1);
+			__m512d sum = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(pn, ps), pw), pe);
+			const __m512d pnew = _mm512_mul_pd(quarter, _mm512_sub_pd(sum, zc));
+			sum = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(zn, zs), zw), ze);
+			const __m512d adv = _mm512_sub_pd(_mm512_mul_pd(_mm512_sub_pd(pe, pw), _mm512_sub_pd(zs, zn)),
+				_mm512_mul_pd(_mm512_sub_pd(ps, pn), _mm512_sub_pd(ze, zw)));
+			const __m512d znew = _mm512_sub_pd(_mm512_mul_pd(quarter, sum), _mm512_mul_pd(re16, adv));
+			_mm512_store_pd(psinew+i*p+j, pnew);
+			_mm512_store_pd(zetnew+i*p+j, znew);
+			const __m512d dp = _mm512_sub_pd(pnew, pc), dz = _mm512_sub_pd(znew, zc);
+			acc = _mm512_add_pd(acc, _mm512_add_pd(_mm512_mul_pd(dp, dp), _mm512_mul_pd(dz, dz)));
 		}
+		for(;j<=n;j++) {
+			dsq+=vortpoint(zetnew,psinew,zet,psi,i,j,p,re);
+		}
+	}
+	return dsq+_mm512_reduce_add_pd(acc);
+}
+
+#endif
+
+typedef void (*stepfn)(double *psinew, double *psi, cfdgrid g);
+typedef void (*stepfnf)(float *psinew, float *psi, cfdgrid g);
+typedef double (*stepvortfn)(double *zetnew, double *psinew, double *zet, double *psi, cfdgrid g, double re);
+
+struct stepkernel {
+	const char *name;
+	stepfn step;
+	stepfnf stepf;
+	stepvortfn stepvort;
+};
+
+// Picks the widest kernel the CPU supports, CFD_SIMD=scalar|avx2|avx512 overrides it
+static stepkernel selectkernel(void)
+{
+	const char *forced = getenv("CFD_SIMD");
+	stepkernel kernel = {"scalar", jacobistep_scalar, jacobistepf_scalar, jacobistepvort_scalar};
+#ifdef JACOBI_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && (forced == NULL || strcmp(forced, "avx2") == 0 || strcmp(forced, "avx512") == 0)) {
+		kernel.name = "avx2";
+		kernel.step = jacobistep_avx2;
+		kernel.stepf = jacobistepf_avx2;
+		kernel.stepvort = jacobistepvort_avx2;
 	}
+	if (__builtin_cpu_supports("avx512f") && (forced == NULL || strcmp(forced, "avx512") == 0)) {
+		kernel.name = "avx512";
+		kernel.step = jacobistep_avx512;
+		kernel.stepf = jacobistepf_avx512;
+		kernel.stepvort = jacobistepvort_avx512;
+	}
+#else
+	(void)forced;
+#endif
+	return kernel;
+}
+
+static const stepkernel kernel = selectkernel();
+
+
+void jacobistep(double *psinew, double *psi, cfdgrid g)
+{
+	kernel.step(psinew, psi, g);
 }
 
 
-double deltasq(double *newarr, double *oldarr, int m, int n)
+void jacobistepf(float *psinew, float *psi, cfdgrid g)
 {
+	kernel.stepf(psinew, psi, g);
+}
+
+
+double jacobistepvort(double *zetnew, double *psinew, double *zet, double *psi, cfdgrid g, double re)
+{
+	return kernel.stepvort(zetnew, psinew, zet, psi, g, re);
+}
+
+
+const char *jacobikernel(void)
+{
+	return kernel.name;
+}
+
+
+double deltasq(double *newarr, double *oldarr, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
 	int i, j;
 
 	double dsq=0.0;
@@ -26,10 +320,65 @@ double deltasq(double *newarr, double *oldarr, int m, int n)
 	{
 		for(j=1;j<=n;j++)
 	{
-		tmp = newarr[i*(m+2)+j]-oldarr[i*(m+2)+j];
+		tmp = newarr[i*p+j]-oldarr[i*p+j];
 		dsq += tmp*tmp;
 		}
 	}
 
 	return dsq;
 }
+
+
+double deltasqf(float *newarr, float *oldarr, cfdgrid g)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	int i, j;
+
+	double dsq=0.0;
+	double tmp;
+
+	for(i=1;i<=m;i++)
+	{
+		for(j=1;j<=n;j++)
+	{
+		tmp = (double)newarr[i*p+j]-(double)oldarr[i*p+j];
+		dsq += tmp*tmp;
+		}
+	}
+
+	return dsq;
+}
+
+
+double sorstep(double *psi, cfdgrid g, double omega)
+{
+	const int m=g.m, n=g.n, p=g.pitch;
+	int i, j, color;
+
+	double dsq=0.0;
+	double tmp;
+
+	for(color=0;color<2;color++)
+	{
+		for(i=1;i<=m;i++)
+		{
+			//first column of this color in row i
+			for(j=1+(i+1+color)%2;j<=n;j+=2)
+			{
+				tmp=omega*(0.25*(psi[(i-1)*p+j]+psi[(i+1)*p+j]+psi[i*p+j-1]+psi[i*p+j+1])-psi[i*p+j]);
+				psi[i*p+j]+=tmp;
+				dsq += tmp*tmp;
+			}
+		}
+	}
+
+	return dsq;
+}
+
+
+double soromega(int m, int n)
+{
+	const double pi = 3.14159265358979323846;
+	const int size = m > n ? m : n;
+	return 2.0/(1.0+sin(pi/(size+1)));
+}
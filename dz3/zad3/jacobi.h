@@ -1,5 +1,30 @@
 //#include <nvtx3/nvToolsExt.h>
 
-void jacobistep(double *psinew, double *psi, int m, int n);
+#include "grid.h"
 
-double deltasq(double *newarr, double *oldarr, int m, int n);
+// The grids are indexed with the pitch of g. The vector kernels use aligned loads, so
+// arrays for jacobistep, jacobistepf and jacobistepvort must come from gridalloc.
+
+void jacobistep(double *psinew, double *psi, cfdgrid g);
+
+// One Jacobi step of the stream function and the vorticity together, both computed
+// from the old psi and zet in a single pass. Returns the sum of the squared changes of
+// both fields, so no deltasq is needed. The zet boundaries are left to boundaryzet.
+double jacobistepvort(double *zetnew, double *psinew, double *zet, double *psi, cfdgrid g, double re);
+
+// Name of the stencil kernel jacobistep uses
+const char *jacobikernel(void);
+
+double deltasq(double *newarr, double *oldarr, cfdgrid g);
+
+// jacobistep and deltasq on single precision grids. The stencil moves half the bytes,
+// the squared changes are still summed in double.
+void jacobistepf(float *psinew, float *psi, cfdgrid g);
+double deltasqf(float *newarr, float *oldarr, cfdgrid g);
+
+// One red-black successive over-relaxation iteration in place: the red points
+// ((i + j) even) first, then the black ones. Returns the sum of the squared changes.
+double sorstep(double *psi, cfdgrid g, double omega);
+
+// Relaxation factor that is optimal for the Laplace equation on this grid
+double soromega(int m, int n);
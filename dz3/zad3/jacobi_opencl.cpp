@@ -12,8 +12,12 @@
 #include <random>
 #include <stdexcept>
 #include <cmath>
+#include <cstring>
+#include <chrono>
 
 #include "jacobi_opencl.hh"
+#include "autotune.hh"
+#include "profile.hh"
 
 #define check(s) {\
 	try {\
@@ -24,7 +28,7 @@
 	}\
 }
 
-Jacobi::Jacobi(int mi, int ni, double* resi, double* psii): m{mi}, n{ni}, res{resi}, psi{psii} {
+Jacobi::Jacobi(cfdgrid g, const double* psi, int batch, bool is_single_precision, Profiler* profiling): m{g.m}, n{g.n}, host_pitch{g.pitch}, is_single{is_single_precision}, profiler{profiling} {
 	std::vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	bool is_device_found{false};
@@ -78,70 +82,466 @@ Jacobi::Jacobi(int mi, int ni, double* resi, double* psii): m{mi}, n{ni}, res{re
 	#endif
 
 	check(context = cl::Context(device));
-	check(queue = cl::CommandQueue(context, device));
+	check(queue = cl::CommandQueue(context, device, profiler != nullptr ? profiler->queue_properties() : 0));
 	
 	source = R"CLC(
-		kernel void step(global double* psinew, global const double* psi, int m, int n) {
+		// The grids hold REAL, float or double; residuals are always summed in double.
+		// Rows are PITCH elements apart, padded to whole cache lines like the host grids.
+		typedef REAL real;
+
+		// Each item updates work consecutive points of a row, the range may overhang the grid
+		kernel void step(global real* psinew, global const real* psi, int m, int n, int work) {
+			const int i = get_global_id(0) + 1;
+			const int j0 = get_global_id(1) * work + 1;
+			if (i > m) return;
+			for (int j = j0; j < j0 + work && j <= n; j++) {
+				psinew[i*PITCH+j] = 0.25f * (psi[(i-1)*PITCH+j] + psi[(i+1)*PITCH+j] + psi[i*PITCH+j-1] + psi[i*PITCH+j+1]);
+			}
+		}
+
+		// step that also writes the sum of the squared changes of its work group to partials.
+		// The work group is TILE x TILE, the range is rounded up to whole tiles.
+		kernel void step_residual(global real* psinew, global const real* psi, int m, int n, global double* partials, local double* sums) {
+			const int i = get_global_id(0) + 1;
+			const int j = get_global_id(1) + 1;
+			const int l = get_local_id(0) * TILE + get_local_id(1);
+			double d = 0.0;
+			if (i <= m && j <= n) {
+				const real v = 0.25f * (psi[(i-1)*PITCH+j] + psi[(i+1)*PITCH+j] + psi[i*PITCH+j-1] + psi[i*PITCH+j+1]);
+				psinew[i*PITCH+j] = v;
+				d = (double)v - psi[i*PITCH+j];
+			}
+			sums[l] = d * d;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int stride = TILE * TILE / 2; stride > 0; stride /= 2) {
+				if (l < stride) {
+					sums[l] += sums[l + stride];
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			if (l == 0) {
+				partials[get_group_id(0) * get_num_groups(1) + get_group_id(1)] = sums[0];
+			}
+		}
+
+		// Half of a red-black SOR iteration in place: updates the points with (i + j) % 2 == color,
+		// which only read points of the other color. The red half (color 0) starts the partial
+		// sums of the iteration, the black half adds to them.
+		kernel void step_sor(global real* psi, int m, int n, double omega, int color, global double* partials, local double* sums) {
 			const int i = get_global_id(0) + 1;
 			const int j = get_global_id(1) + 1;
-			psinew[i*(m+2)+j] = 0.25 * (psi[(i-1)*(m+2)+j] + psi[(i+1)*(m+2)+j] + psi[i*(m+2)+j-1] + psi[i*(m+2)+j+1]);
+			const int l = get_local_id(0) * TILE + get_local_id(1);
+			double d = 0.0;
+			if (i <= m && j <= n && (i + j) % 2 == color) {
+				d = omega * (0.25f * (psi[(i-1)*PITCH+j] + psi[(i+1)*PITCH+j] + psi[i*PITCH+j-1] + psi[i*PITCH+j+1]) - psi[i*PITCH+j]);
+				psi[i*PITCH+j] += d;
+			}
+			sums[l] = d * d;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int stride = TILE * TILE / 2; stride > 0; stride /= 2) {
+				if (l < stride) {
+					sums[l] += sums[l + stride];
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			if (l == 0) {
+				const int g = get_group_id(0) * get_num_groups(1) + get_group_id(1);
+				partials[g] = color == 0 ? sums[0] : partials[g] + sums[0];
+			}
+		}
+
+		// Stream function and vorticity in one pass from the old psi and zet, with the partial
+		// sums of the squared changes of both like step_residual.
+		kernel void step_vort(global real* zetnew, global real* psinew, global const real* zet, global const real* psi, int m, int n, double re, global double* partials, local double* sums) {
+			const int i = get_global_id(0) + 1;
+			const int j = get_global_id(1) + 1;
+			const int l = get_local_id(0) * TILE + get_local_id(1);
+			double d = 0.0;
+			if (i <= m && j <= n) {
+				const int k = i*PITCH+j;
+				const real p = 0.25f * (psi[k-PITCH] + psi[k+PITCH] + psi[k-1] + psi[k+1] - zet[k]);
+				const real z = 0.25f * (zet[k-PITCH] + zet[k+PITCH] + zet[k-1] + zet[k+1])
+					- (real)(re / 16.0) * ((psi[k+1] - psi[k-1]) * (zet[k+PITCH] - zet[k-PITCH])
+						- (psi[k+PITCH] - psi[k-PITCH]) * (zet[k+1] - zet[k-1]));
+				psinew[k] = p;
+				zetnew[k] = z;
+				const double dp = (double)p - psi[k];
+				const double dz = (double)z - zet[k];
+				d = dp * dp + dz * dz;
+			}
+			sums[l] = d;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int stride = TILE * TILE / 2; stride > 0; stride /= 2) {
+				if (l < stride) {
+					sums[l] += sums[l + stride];
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			if (l == 0) {
+				partials[get_group_id(0) * get_num_groups(1) + get_group_id(1)] = sums[0];
+			}
+		}
+
+		// Vorticity on the walls from the stream function next to them, see boundaryzet.
+		// Work item k sets the k-th cell of every wall.
+		kernel void boundary_zet(global real* zet, global const real* psi, int m, int n) {
+			const int k = get_global_id(0) + 1;
+			if (k <= m) {
+				zet[k*PITCH] = 2.0f * (psi[k*PITCH+1] - psi[k*PITCH]);
+				zet[k*PITCH+n+1] = 2.0f * (psi[k*PITCH+n] - psi[k*PITCH+n+1]);
+			}
+			if (k <= n) {
+				zet[k] = 2.0f * (psi[PITCH+k] - psi[k]);
+				zet[(m+1)*PITCH+k] = 2.0f * (psi[m*PITCH+k] - psi[(m+1)*PITCH+k]);
+			}
+		}
+
+		// k sweeps over a TILE x TILE block of the grid. The block and a halo of width k
+		// are loaded into local memory; sweep s is valid up to k - s cells outside the
+		// block, so after k sweeps the block itself is exact. The arithmetic is the same
+		// as in step, so the results are bitwise equal.
+		kernel void step_tiled(global real* psinew, global const real* psi, int m, int n, int k, local real* a, local real* b) {
+			const int li = get_local_id(0);
+			const int lj = get_local_id(1);
+			const int w = TILE + 2 * k;
+			// Global position of the local cell (0, 0)
+			const int i0 = get_group_id(0) * TILE + 1 - k;
+			const int j0 = get_group_id(1) * TILE + 1 - k;
+
+			for (int x = li; x < w; x += TILE) {
+				for (int y = lj; y < w; y += TILE) {
+					const int i = i0 + x;
+					const int j = j0 + y;
+					// Cells outside the grid only neighbor fixed boundary cells
+					a[x*w+y] = (i >= 0 && i <= m+1 && j >= 0 && j <= n+1) ? psi[i*PITCH+j] : 0.0f;
+				}
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			for (int s = 1; s <= k; ++s) {
+				for (int x = li; x < w; x += TILE) {
+					for (int y = lj; y < w; y += TILE) {
+						const int i = i0 + x;
+						const int j = j0 + y;
+						const bool is_valid = x >= s && x < w - s && y >= s && y < w - s;
+						const bool is_interior = i >= 1 && i <= m && j >= 1 && j <= n;
+						if (is_valid && is_interior) {
+							b[x*w+y] = 0.25f * (a[(x-1)*w+y] + a[(x+1)*w+y] + a[x*w+y-1] + a[x*w+y+1]);
+						} else {
+							b[x*w+y] = a[x*w+y];
+						}
+					}
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+				local real* t = a;
+				a = b;
+				b = t;
+			}
+
+			const int x = li + k;
+			const int y = lj + k;
+			const int i = i0 + x;
+			const int j = j0 + y;
+			if (i <= m && j <= n) {
+				psinew[i*PITCH+j] = a[x*w+y];
+			}
 		}
 	)CLC";
-	check(program = cl::Program(context, source));
-	try {
-		check(program.build("-cl-std=CL2.0"));
-	} catch (...) {
-		cl_int build_err{CL_SUCCESS};
-		auto build_info{program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device, &build_err)};
-		std::cerr << build_info << std::endl << std::endl;
-		throw;
-	}
-
-	size = (m + 2) * (n + 2) * sizeof(double);
-	check(kernel = cl::Kernel(program, "step"));
-	check(output = cl::Buffer(context, CL_MEM_WRITE_ONLY, size));
-	check(input = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, size, psi));
-	check(kernel.setArg(0, output));
-	check(kernel.setArg(1, input));
+
+	// Square tiles that fit into a work group, and as many sweeps per launch as two
+	// tiles with their halos fit into local memory
+	const std::size_t real_size{is_single ? sizeof(float) : sizeof(double)};
+	pitch = is_single ? makegrid(m, n, sizeof(float)).pitch : host_pitch;
+	const std::size_t max_group{device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()};
+	tile = max_group >= 256 ? 16 : 8;
+
+	const auto build{[&]() {
+		check(program = cl::Program(context, source));
+		try {
+			const std::string options{"-cl-std=CL2.0 -D TILE=" + std::to_string(tile) + " -D PITCH=" + std::to_string(pitch) +
+				(is_single ? " -D REAL=float" : " -D REAL=double")};
+			check(program.build(options.c_str()));
+		} catch (...) {
+			cl_int build_err{CL_SUCCESS};
+			auto build_info{program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device, &build_err)};
+			std::cerr << build_info << std::endl << std::endl;
+			throw;
+		}
+		check(kernel = cl::Kernel(program, "step"));
+		check(tiled_kernel = cl::Kernel(program, "step_tiled"));
+		check(residual_kernel = cl::Kernel(program, "step_residual"));
+		check(sor_kernel = cl::Kernel(program, "step_sor"));
+		check(vort_kernel = cl::Kernel(program, "step_vort"));
+		check(zet_kernel = cl::Kernel(program, "boundary_zet"));
+	}};
+	build();
+	// The tiled kernels can take fewer items per group than the device, e.g. when they use
+	// many registers, then they only launch with the smaller tiles
+	if (tile == 16) {
+		std::size_t kernel_group{max_group};
+		for (const cl::Kernel* tiled : {&residual_kernel, &sor_kernel, &vort_kernel, &tiled_kernel}) {
+			kernel_group = std::min(kernel_group, tiled->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+		}
+		if (kernel_group < 256) {
+			tile = 8;
+			build();
+		}
+	}
+
+	const cl_ulong local_mem{device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()};
+	batch_size = 1;
+	while (batch_size < batch) {
+		const std::size_t edge = tile + 2 * (batch_size + 1);
+		if (2 * edge * edge * real_size > local_mem) break;
+		batch_size++;
+	}
+
+	size = static_cast<std::size_t>(m + 2) * pitch * real_size;
+	// CPU devices and integrated GPUs sweep host memory anyway, so the grids can stay in
+	// an arena on huge pages. Zero-copy wants the address aligned as the device says,
+	// Intel asks for whole pages.
+	if (device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU || device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>()) {
+		host_align = std::max<std::size_t>(4096, device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8);
+		gridarena* grids_arena{arenacreate(4 * (size + host_align))};
+		if (grids_arena != nullptr) {
+			arena.reset(grids_arena, arenafree);
+		}
+	}
+	// The kernel only writes the interior, both grids need the boundaries
+	for (cl::Buffer& grid : grids) {
+		grid = upload(psi);
+	}
 	check(kernel.setArg(2, m));
 	check(kernel.setArg(3, n));
+	tune_step();
+	check(tiled_kernel.setArg(2, m));
+	check(tiled_kernel.setArg(3, n));
+
+	const std::size_t groups{static_cast<std::size_t>((m + tile - 1) / tile) * ((n + tile - 1) / tile)};
+	host_partials.resize(groups);
+	check(partials = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, groups * sizeof(double)));
+	check(residual_kernel.setArg(2, m));
+	check(residual_kernel.setArg(3, n));
+	check(residual_kernel.setArg(4, partials));
+	check(residual_kernel.setArg(5, cl::Local(tile * tile * sizeof(double))));
+	check(sor_kernel.setArg(1, m));
+	check(sor_kernel.setArg(2, n));
+	check(sor_kernel.setArg(5, partials));
+	check(sor_kernel.setArg(6, cl::Local(tile * tile * sizeof(double))));
+	check(vort_kernel.setArg(4, m));
+	check(vort_kernel.setArg(5, n));
+	check(vort_kernel.setArg(7, partials));
+	check(vort_kernel.setArg(8, cl::Local(tile * tile * sizeof(double))));
+	check(zet_kernel.setArg(2, m));
+	check(zet_kernel.setArg(3, n));
+}
+
+static void CL_CALLBACK release_arena(cl_mem, void* arena) {
+	delete static_cast<std::shared_ptr<gridarena>*>(arena);
 }
 
-void Jacobi::step() {
-	check(queue.enqueueWriteBuffer(input, CL_FALSE, 0, size, psi));
-	check(queue.enqueueNDRangeKernel(kernel, cl::NDRange(0, 0), cl::NDRange(m, n)));
-	check(queue.finish());
-	check(queue.enqueueReadBuffer(output, CL_TRUE, 0, size, res));
+cl::Buffer Jacobi::upload(const double* values) {
+	std::vector<float> single;
+	void* host{const_cast<double*>(values)};
+	if (is_single) {
+		single.assign(static_cast<std::size_t>(m + 2) * pitch, 0.0f);
+		for (int i{0}; i < m + 2; ++i) {
+			std::copy(values + i * host_pitch, values + i * host_pitch + n + 2, single.begin() + i * pitch);
+		}
+		host = single.data();
+	}
+	cl::Buffer buffer;
+	void* in_place{arena ? arenaallochost(arena.get(), size, host_align) : nullptr};
+	if (in_place == nullptr) {
+		// An explicit write rather than CL_MEM_COPY_HOST_PTR, so the profile shows the transfer
+		check(buffer = cl::Buffer(context, CL_MEM_READ_WRITE, size));
+		check(queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, size, host, nullptr, record("upload")));
+		return buffer;
+	}
+	std::memcpy(in_place, host, size);
+	check(buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, in_place));
+	// The runtime may release the buffer after this object is gone, the arena must outlive it
+	if (clSetMemObjectDestructorCallback(buffer(), release_arena, new std::shared_ptr<gridarena>(arena)) != CL_SUCCESS) {
+		throw std::runtime_error("Can't tie the grid arena to its buffer");
+	}
+	return buffer;
 }
 
+void Jacobi::download(const cl::Buffer& buffer, double* values, bool is_blocking) {
+	if (!is_single) {
+		check(queue.enqueueReadBuffer(buffer, is_blocking ? CL_TRUE : CL_FALSE, 0, size, values, nullptr, record("download")));
+		return;
+	}
+	std::vector<float> single(static_cast<std::size_t>(m + 2) * pitch);
+	check(queue.enqueueReadBuffer(buffer, CL_TRUE, 0, size, single.data(), nullptr, record("download")));
+	for (int i{0}; i < m + 2; ++i) {
+		std::copy(single.begin() + i * pitch, single.begin() + i * pitch + n + 2, values + i * host_pitch);
+	}
+}
 
-void jacobistep(double *psinew, double *psi, int m, int n)
-{
-	int i, j;
-  
-	for(i=1;i<=m;i++) {
-		for(j=1;j<=n;j++) {
-		psinew[i*(m+2)+j]=0.25*(psi[(i-1)*(m+2)+j]+psi[(i+1)*(m+2)+j]+psi[i*(m+2)+j-1]+psi[i*(m+2)+j+1]);
+void Jacobi::tune_step() {
+	const auto start{std::chrono::steady_clock::now()};
+	// Times a few sweeps between two scratch copies of the grid for every candidate, the
+	// grids themselves stay as uploaded
+	cl::Buffer scratch[2];
+	for (cl::Buffer& buffer : scratch) {
+		check(buffer = cl::Buffer(context, CL_MEM_READ_WRITE, size));
+		check(queue.enqueueCopyBuffer(grids[current], buffer, 0, 0, size));
+	}
+	const std::string key{"jacobi step " + std::to_string(m) + "x" + std::to_string(n) + (is_single ? " float" : " double")};
+	Autotuner tuner(device);
+	const Launch best{tuner.tune(key, Autotuner::tiles(kernel, device, {1, 2, 4, 8}), [&](const Launch& launch) {
+		for (int k{0}; k < 10; ++k) {
+			kernel.setArg(0, scratch[1 - k % 2]);
+			kernel.setArg(1, scratch[k % 2]);
+			enqueue_step(launch);
 		}
+		queue.finish();
+	})};
+	step_local[0] = best.local[0];
+	step_local[1] = best.local[1];
+	step_work = best.work_per_item;
+	tuning_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+cl::Event* Jacobi::record(const char* name) {
+	return profiler != nullptr ? profiler->record(name) : nullptr;
+}
+
+void Jacobi::enqueue_step(const Launch& launch, cl::Event* event) {
+	kernel.setArg(4, static_cast<int>(launch.work_per_item));
+	std::size_t rows{static_cast<std::size_t>(m)};
+	std::size_t cols{(n + launch.work_per_item - 1) / launch.work_per_item};
+	if (launch.local[0] == 0 || launch.local[1] == 0) {
+		queue.enqueueNDRangeKernel(kernel, cl::NDRange(0, 0), cl::NDRange(rows, cols), cl::NullRange, nullptr, event);
+		return;
 	}
+	rows = (rows + launch.local[0] - 1) / launch.local[0] * launch.local[0];
+	cols = (cols + launch.local[1] - 1) / launch.local[1] * launch.local[1];
+	queue.enqueueNDRangeKernel(kernel, cl::NDRange(0, 0), cl::NDRange(rows, cols), cl::NDRange(launch.local[0], launch.local[1]), nullptr, event);
 }
 
+void Jacobi::sweep() {
+	check(kernel.setArg(0, grids[1 - current]));
+	check(kernel.setArg(1, grids[current]));
+	Launch launch;
+	launch.local[0] = step_local[0];
+	launch.local[1] = step_local[1];
+	launch.work_per_item = step_work;
+	check(enqueue_step(launch, record("step")));
+	current = 1 - current;
+}
 
-double deltasq(const std::vector<double>& newarr, const std::vector<double>& oldarr, int m, int n)
-{
-	int i, j;
+void Jacobi::sweep_tiled(int k) {
+	const std::size_t edge = tile + 2 * k;
+	const std::size_t rows = (m + tile - 1) / tile * tile;
+	const std::size_t cols = (n + tile - 1) / tile * tile;
+	check(tiled_kernel.setArg(0, grids[1 - current]));
+	check(tiled_kernel.setArg(1, grids[current]));
+	check(tiled_kernel.setArg(4, k));
+	const std::size_t real_size{is_single ? sizeof(float) : sizeof(double)};
+	check(tiled_kernel.setArg(5, cl::Local(edge * edge * real_size)));
+	check(tiled_kernel.setArg(6, cl::Local(edge * edge * real_size)));
+	check(queue.enqueueNDRangeKernel(tiled_kernel, cl::NDRange(0, 0), cl::NDRange(rows, cols), cl::NDRange(tile, tile), nullptr, record("step_tiled")));
+	current = 1 - current;
+}
 
-	double dsq=0.0;
-	double tmp;
+void Jacobi::sweep_residual() {
+	const std::size_t rows = (m + tile - 1) / tile * tile;
+	const std::size_t cols = (n + tile - 1) / tile * tile;
+	check(residual_kernel.setArg(0, grids[1 - current]));
+	check(residual_kernel.setArg(1, grids[current]));
+	check(queue.enqueueNDRangeKernel(residual_kernel, cl::NDRange(0, 0), cl::NDRange(rows, cols), cl::NDRange(tile, tile), nullptr, record("step_residual")));
+	current = 1 - current;
+}
 
-	for(i=1;i<=m;i++)
-	{
-		for(j=1;j<=n;j++)
-	{
-		tmp = newarr[i*(m+2)+j]-oldarr[i*(m+2)+j];
-		dsq += tmp*tmp;
+void Jacobi::step(int count) {
+	for (int remaining{count - 1}; remaining > 0;) {
+		const int k{std::min(remaining, batch_size)};
+		if (k == 1) {
+			sweep();
+		} else {
+			sweep_tiled(k);
 		}
+		remaining -= k;
 	}
+	if (count > 0) {
+		sweep_residual();
+	}
+}
 
+void Jacobi::sor(int count, double omega) {
+	const std::size_t rows = (m + tile - 1) / tile * tile;
+	const std::size_t cols = (n + tile - 1) / tile * tile;
+	check(sor_kernel.setArg(0, grids[current]));
+	check(sor_kernel.setArg(3, omega));
+	for (int iteration{0}; iteration < count; ++iteration) {
+		for (const int color : {0, 1}) {
+			check(sor_kernel.setArg(4, color));
+			check(queue.enqueueNDRangeKernel(sor_kernel, cl::NDRange(0, 0), cl::NDRange(rows, cols), cl::NDRange(tile, tile), nullptr, record("step_sor")));
+		}
+	}
+}
+
+double Jacobi::sor_omega(int m, int n) {
+	const double pi{3.14159265358979323846};
+	return 2.0 / (1.0 + std::sin(pi / (std::max(m, n) + 1)));
+}
+
+double Jacobi::residual() {
+	check(queue.enqueueReadBuffer(partials, CL_TRUE, 0, host_partials.size() * sizeof(double), host_partials.data(), nullptr, record("partials")));
+	double dsq{0.0};
+	for (const double partial : host_partials) {
+		dsq += partial;
+	}
 	return dsq;
 }
+
+double Jacobi::get_tuning_seconds() const {
+	return tuning_seconds;
+}
+
+int Jacobi::get_batch_size() const {
+	return batch_size;
+}
+
+void Jacobi::read(double* psi, double* psiprev) {
+	download(grids[1 - current], psiprev, false);
+	download(grids[current], psi, true);
+}
+
+void Jacobi::vorticity(const double* zet, double reynolds) {
+	re = reynolds;
+	for (cl::Buffer& grid : zets) {
+		grid = upload(zet);
+	}
+	check(vort_kernel.setArg(6, re));
+}
+
+void Jacobi::step_vort(int count) {
+	const std::size_t rows = (m + tile - 1) / tile * tile;
+	const std::size_t cols = (n + tile - 1) / tile * tile;
+	for (int iteration{0}; iteration < count; ++iteration) {
+		check(vort_kernel.setArg(0, zets[1 - current]));
+		check(vort_kernel.setArg(1, grids[1 - current]));
+		check(vort_kernel.setArg(2, zets[current]));
+		check(vort_kernel.setArg(3, grids[current]));
+		check(queue.enqueueNDRangeKernel(vort_kernel, cl::NDRange(0, 0), cl::NDRange(rows, cols), cl::NDRange(tile, tile), nullptr, record("step_vort")));
+		check(zet_kernel.setArg(0, zets[1 - current]));
+		check(zet_kernel.setArg(1, grids[1 - current]));
+		check(queue.enqueueNDRangeKernel(zet_kernel, cl::NDRange(0), cl::NDRange(std::max(m, n)), cl::NullRange, nullptr, record("boundary_zet")));
+		current = 1 - current;
+	}
+}
+
+void Jacobi::read_vorticity(double* zet) {
+	download(zets[current], zet, true);
+}
+
+bool Jacobi::is_single_precision() const {
+	return is_single;
+}
+
+bool Jacobi::is_zero_copy() const {
+	return arena != nullptr;
+}
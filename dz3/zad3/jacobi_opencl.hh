@@ -1,14 +1,27 @@
 //#include <nvtx3/nvToolsExt.h>
 
 #include <cstdio>
+#include <memory>
+#include <vector>
 #include "CL/cl.hpp"
 
+#include "grid.h"
+
+struct Launch;
+class Profiler;
+
+// Jacobi iteration that keeps both grids on the device. They swap roles after every
+// sweep, so nothing crosses the bus until the host asks for the grids.
 class Jacobi {
 private:
 	int m;
 	int n;
-	double* res;
-	double* psi;
+	// Elements between rows of the host grids and of the device grids. In double they
+	// are the same, float rows are padded to their own cache lines.
+	int host_pitch;
+	int pitch;
+	// Grids of float instead of double
+	bool is_single{false};
 	std::size_t size;
 	cl::Device device;
 	cl::Context context;
@@ -16,12 +29,86 @@ private:
 	cl::Program program;
 	cl::CommandQueue queue;
 	cl::Kernel kernel;
-	cl::Buffer output;
-	cl::Buffer input;
+	// Work-group shape, 0 for the implementation's, and points per item of kernel,
+	// autotuned for the device
+	std::size_t step_local[2]{0, 0};
+	std::size_t step_work{1};
+	// Seconds the constructor spent picking them, little once they are cached
+	double tuning_seconds{0.0};
+	// Applies several sweeps to a tile held in local memory
+	cl::Kernel tiled_kernel;
+	// One sweep that also sums the squared change per work group
+	cl::Kernel residual_kernel;
+	// Red or black half of an in-place SOR iteration, with the same partial sums
+	cl::Kernel sor_kernel;
+	// Fused psi and zeta step with the partial sums of both, and the zeta walls
+	cl::Kernel vort_kernel;
+	cl::Kernel zet_kernel;
+	cl::Buffer partials;
+	std::vector<double> host_partials;
+	// Sweeps per launch of the tiled kernel
+	int batch_size{1};
+	// Work-group tile edge of the tiled kernel
+	int tile{16};
+	// grids[current] holds the latest iterate
+	cl::Buffer grids[2];
+	int current{0};
+	// Vorticity, swapped together with the grids
+	cl::Buffer zets[2];
+	double re{0.0};
+	// Host memory the grids live in when the device works on host memory, null when they
+	// are copied to the device. Every buffer in it keeps it alive.
+	std::shared_ptr<gridarena> arena;
+	std::size_t host_align{0};
+	// Gets an event for every enqueued command when set, see profile.hh
+	Profiler* profiler{nullptr};
+
+	// Copies a host grid to a new device buffer, narrowed to float in single precision
+	cl::Buffer upload(const double* values);
+	void download(const cl::Buffer& buffer, double* values, bool is_blocking);
+	// Picks the launch of kernel with the autotuner, see autotune.hh
+	void tune_step();
+	void enqueue_step(const Launch& launch, cl::Event* event = nullptr);
+	// The profiler's event for a command, nullptr when not profiling
+	cl::Event* record(const char* name);
+	void sweep();
+	void sweep_tiled(int k);
+	void sweep_residual();
 public:
-	Jacobi(int m, int n, double* res, double* psi);
+	// Uploads psi with the layout g, boundaries included, into both grids. Up to
+	// batch_size sweeps run in one launch, limited by the local memory of the device.
+	// read() and read_vorticity() fill host grids with the same layout. In single precision
+	// the grids are stored and swept as float, which halves the traffic, while the
+	// residual is still summed in double.
+	// With a profiler, the queue is created for profiling and every command is recorded.
+	Jacobi(cfdgrid g, const double* psi, int batch_size = 1, bool is_single_precision = false, Profiler* profiler = nullptr);
 	Jacobi() = default;
-	void step();
+	// Enqueues count sweeps without waiting for them. All but the last one run in
+	// batches, the last one alone, so read() always returns two consecutive iterates.
+	// The last sweep also computes the residual on the device.
+	void step(int count = 1);
+	// Sum of the squared changes of the last sweep, see deltasq. Only reads one double
+	// per work group.
+	double residual();
+	// Enqueues count red-black SOR iterations on the latest grid instead. residual()
+	// then returns the squared change of the last iteration, read() only fills psi
+	// with something meaningful.
+	void sor(int count, double omega);
+	// Uploads the vorticity, boundaries included, for step_vort
+	void vorticity(const double* zet, double re);
+	// Enqueues count fused steps of the stream function and the vorticity, each followed
+	// by the zeta boundary conditions. residual() then covers both fields.
+	void step_vort(int count);
+	// Waits for the enqueued steps and copies the latest vorticity into zet
+	void read_vorticity(double* zet);
+	// Relaxation factor that is optimal for the Laplace equation on an m x n grid
+	static double sor_omega(int m, int n);
+	int get_batch_size() const;
+	double get_tuning_seconds() const;
+	bool is_single_precision() const;
+	// The grids are used in place in host memory instead of copied
+	bool is_zero_copy() const;
+	// Waits for the enqueued sweeps and copies the latest iterate into psi and the one before it into psiprev,
+	// widened to double in single precision.
+	void read(double* psi, double* psiprev);
 };
-
-double deltasq(const std::vector<double>& newarr, const std::vector<double>& oldarr, int m, int n);
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "jacobi_threads.hh"
+#include "boundary.h"
+
+// Keeps a thread on one CPU, so the rows it first touched stay local to it
+static void pin_thread(std::thread::native_handle_type handle, int thread) {
+#ifdef __linux__
+	const unsigned cpus{std::max(1u, std::thread::hardware_concurrency())};
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(thread % cpus, &set);
+	pthread_setaffinity_np(handle, sizeof(set), &set);
+#else
+	(void)handle;
+	(void)thread;
+#endif
+}
+
+ThreadPool::ThreadPool(int threads) {
+	if (threads < 1) {
+		throw std::invalid_argument("a thread pool needs at least one thread");
+	}
+#ifdef __linux__
+	// The calling thread is thread 0
+	pin_thread(pthread_self(), 0);
+#endif
+	for (int thread{1}; thread < threads; ++thread) {
+		workers.emplace_back(&ThreadPool::work, this, thread);
+		pin_thread(workers.back().native_handle(), thread);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	is_stopping.store(true, std::memory_order_release);
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+int ThreadPool::size() const {
+	return static_cast<int>(workers.size()) + 1;
+}
+
+void ThreadPool::run(const std::function<void(int)>& j) {
+	job = j;
+	pending.store(static_cast<int>(workers.size()), std::memory_order_relaxed);
+	generation.fetch_add(1, std::memory_order_release);
+	job(0);
+	while (pending.load(std::memory_order_acquire) > 0) {
+		std::this_thread::yield();
+	}
+}
+
+void ThreadPool::work(int thread) {
+	unsigned seen{0};
+	while (true) {
+		// Spin between iterations, a sweep is far shorter than a sleep
+		while (generation.load(std::memory_order_acquire) == seen) {
+			if (is_stopping.load(std::memory_order_acquire)) return;
+			std::this_thread::yield();
+		}
+		seen++;
+		job(thread);
+		pending.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+JacobiThreads::JacobiThreads(int mi, int ni, int threads): m{mi}, n{ni}, pool{threads}, partials(threads) {
+	const cfdgrid layout{makegrid(m, n, sizeof(double))};
+	pitch = layout.pitch;
+	// The arena doesn't touch the pages, the owning threads do
+	arena = arenacreate(2 * arenabytes(layout, sizeof(double)));
+	if (arena == nullptr) {
+		throw std::bad_alloc();
+	}
+	psi = arenaalloc(arena, layout);
+	psinew = arenaalloc(arena, layout);
+	pool.run([this](int thread) {
+		// The first and the last thread also own the boundary rows
+		const int begin{thread == 0 ? 0 : first_row(thread)};
+		const int end{thread == pool.size() - 1 ? m + 2 : first_row(thread + 1)};
+		for (int i{begin}; i < end; ++i) {
+			for (int j{0}; j < pitch; ++j) {
+				psi[i*pitch+j] = 0.0;
+				psinew[i*pitch+j] = 0.0;
+			}
+		}
+	});
+}
+
+JacobiThreads::~JacobiThreads() {
+	arenafree(arena);
+}
+
+int JacobiThreads::first_row(int thread) const {
+	return 1 + static_cast<int>(static_cast<long>(m) * thread / pool.size());
+}
+
+void JacobiThreads::boundary(int b, int h, int w) {
+	const cfdgrid layout{m, n, pitch};
+	boundarypsi(psi, layout, b, h, w);
+	boundarypsi(psinew, layout, b, h, w);
+}
+
+double JacobiThreads::step() {
+	pool.run([this](int thread) {
+		double dsq{0.0};
+		const int end{first_row(thread + 1)};
+		for (int i{first_row(thread)}; i < end; ++i) {
+			for (int j{1}; j <= n; ++j) {
+				const double v{0.25*(psi[(i-1)*pitch+j]+psi[(i+1)*pitch+j]+psi[i*pitch+j-1]+psi[i*pitch+j+1])};
+				const double d{v - psi[i*pitch+j]};
+				psinew[i*pitch+j] = v;
+				dsq += d*d;
+			}
+		}
+		partials[thread].dsq = dsq;
+	});
+	std::swap(psi, psinew);
+	double dsq{0.0};
+	for (const Partial& p : partials) {
+		dsq += p.dsq;
+	}
+	return dsq;
+}
+
+const double* JacobiThreads::grid() const {
+	return psi;
+}
+
+int JacobiThreads::row_pitch() const {
+	return pitch;
+}
+
+int JacobiThreads::threads() const {
+	return pool.size();
+}
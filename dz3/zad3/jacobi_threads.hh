@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "grid.h"
+
+// Persistent workers that run one job at a time. The calling thread takes part as
+// thread 0, so a pool of size 1 has no workers at all.
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::function<void(int)> job;
+	alignas(64) std::atomic<unsigned> generation{0};
+	alignas(64) std::atomic<int> pending{0};
+	std::atomic<bool> is_stopping{false};
+
+	void work(int thread);
+public:
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	int size() const;
+	// Calls job(thread) on every thread and returns once all of them are done.
+	void run(const std::function<void(int)>& job);
+};
+
+// Jacobi iteration on the CPU. Every thread owns a block of rows and does the sweep,
+// the residual and nothing else in one pass; the grids swap by pointer afterwards.
+// The rows are first touched by the thread that owns them, so on a NUMA machine their
+// pages end up on the node that sweeps them. Both grids share one arena on huge pages,
+// which places memory in 2 MB pieces, so a row block only stays local if it spans them.
+class JacobiThreads {
+private:
+	int m;
+	int n;
+	// Elements between rows, see cfdgrid
+	int pitch;
+	ThreadPool pool;
+	gridarena* arena;
+	double* psi;
+	double* psinew;
+	// Per-thread partial residuals, each on its own cache line
+	struct alignas(64) Partial {
+		double dsq;
+	};
+	std::vector<Partial> partials;
+
+	int first_row(int thread) const;
+public:
+	// Zeroes both (m+2) x (n+2) grids, padded like gridalloc, in parallel.
+	JacobiThreads(int m, int n, int threads);
+	~JacobiThreads();
+	JacobiThreads(const JacobiThreads&) = delete;
+	JacobiThreads& operator=(const JacobiThreads&) = delete;
+	// Sets the boundary conditions on both grids.
+	void boundary(int b, int h, int w);
+	// One sweep, returns the sum of the squared changes like deltasq.
+	double step();
+	// The latest iterate, point (i, j) is at i * row_pitch() + j
+	const double* grid() const;
+	int row_pitch() const;
+	int threads() const;
+};
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multigrid.h"
+#include "jacobi.h"
+
+// Red-black Gauss-Seidel sweeps on every level, before and after the coarse correction
+static const int PRESMOOTH=2;
+static const int POSTSMOOTH=2;
+// SOR sweeps on the coarsest level. It is 4 x 4 unless m or n has an odd factor, and
+// SOR needs O(size) sweeps where Gauss-Seidel would need O(size^2).
+static const int COARSESWEEPS=64;
+
+// Coefficients of the 1D second difference along one axis of a level, per index 1..size:
+// H^2 u'' ~ lo*u[k-1] + hi*u[k+1] - diag*u[k]. Coarse cell centres don't line up with the
+// fine boundary nodes, so the first and the last cell use the real distance to the wall.
+struct mgaxis {
+	double *lo, *hi, *diag;
+	double *weight; //prolongation weight of the covering coarse cell, per fine index
+};
+
+struct mglevel {
+	int m, n, p; //p is the row pitch
+	double *u; //solution, or correction on the coarse levels
+	double *f; //right hand side, NULL on the finest level
+	double *r; //residual
+	mgaxis rows, cols;
+};
+
+struct multigrid {
+	int levels;
+	mglevel *level;
+	//the arena the level grids come from, NULL if they are on the heap
+	gridarena *arena;
+};
+
+static void *checked(size_t size)
+{
+	void *a = calloc(size, 1);
+	if (a == NULL) {
+		printf("Out of memory for a multigrid level\n");
+		exit(1);
+	}
+	return a;
+}
+
+static double *zeroed(cfdgrid g, gridarena *arena)
+{
+	double *a = arena != NULL ? arenaalloc(arena, g) : gridalloc(g);
+	if (a == NULL) {
+		printf("Out of memory for a multigrid level\n");
+		exit(1);
+	}
+	memset(a, 0, gridsize(g)*sizeof(double));
+	return a;
+}
+
+// Level l has spacing H = 2^l fine cells and its first cell centre is H/2 + 1/2 from the
+// wall, which is exactly one spacing on the finest level.
+static void setaxis(mgaxis *axis, int size, int l)
+{
+	const double H = (double)(1<<l);
+	const double d = 0.5*H+0.5;
+	axis->lo = (double *) checked((size+2)*sizeof(double));
+	axis->hi = (double *) checked((size+2)*sizeof(double));
+	axis->diag = (double *) checked((size+2)*sizeof(double));
+	axis->weight = (double *) checked((2*size+2)*sizeof(double));
+	for (int k=1;k<=size;k++) {
+		axis->lo[k]=1.0;
+		axis->hi[k]=1.0;
+		axis->diag[k]=2.0;
+	}
+	//Shortley-Weller at the walls, the wall side multiplies a boundary value
+	axis->diag[1]=axis->diag[size]=2.0*H/d;
+	axis->hi[1]=axis->lo[size]=2.0*H/(d+H);
+	axis->lo[1]=axis->hi[size]=2.0*H/d-2.0*H/(d+H);
+
+	//a fine cell of level l-1 takes 3/4 of the coarse cell covering it, except next to
+	//the wall, where it interpolates between the coarse cell and zero at the wall
+	const double h = 0.5*H;
+	for (int k=1;k<=2*size;k++) {
+		axis->weight[k]=0.75;
+	}
+	axis->weight[1]=axis->weight[2*size]=(0.5*h+0.5)/(h+0.5);
+}
+
+static void freeaxis(mgaxis *axis)
+{
+	free(axis->lo);
+	free(axis->hi);
+	free(axis->diag);
+	free(axis->weight);
+}
+
+static int countlevels(int m, int n)
+{
+	int levels=1;
+	while ((m>>(levels-1))%2 == 0 && (n>>(levels-1))%2 == 0 &&
+			(m>>levels) >= 4 && (n>>levels) >= 4) {
+		levels++;
+	}
+	return levels;
+}
+
+size_t mgarenabytes(cfdgrid g)
+{
+	//the residual on every level, the solution and the right hand side below the finest
+	const int levels=countlevels(g.m,g.n);
+	size_t bytes=arenabytes(g,sizeof(double));
+	for (int l=1;l<levels;l++) {
+		bytes += 3*arenabytes(makegrid(g.m>>l,g.n>>l,sizeof(double)),sizeof(double));
+	}
+	return bytes;
+}
+
+multigrid *mgcreate(cfdgrid g, gridarena *arena)
+{
+	const int m=g.m, n=g.n;
+	multigrid *mg = (multigrid *) checked(sizeof(multigrid));
+
+	mg->levels=countlevels(m,n);
+	mg->arena=arena;
+
+	mg->level = (mglevel *) checked(mg->levels*sizeof(mglevel));
+	for (int l=0;l<mg->levels;l++) {
+		mglevel *lv = &mg->level[l];
+		const cfdgrid lg = l == 0 ? g : makegrid(m>>l, n>>l, sizeof(double));
+		lv->m = lg.m;
+		lv->n = lg.n;
+		lv->p = lg.pitch;
+		//the finest level works on the caller's psi
+		lv->u = l == 0 ? NULL : zeroed(lg,arena);
+		lv->f = l == 0 ? NULL : zeroed(lg,arena);
+		lv->r = zeroed(lg,arena);
+		setaxis(&lv->rows, lv->m, l);
+		setaxis(&lv->cols, lv->n, l);
+	}
+
+	return mg;
+}
+
+void mgfree(multigrid *mg)
+{
+	for (int l=0;l<mg->levels;l++) {
+		if (mg->arena == NULL) {
+			gridfree(mg->level[l].u);
+			gridfree(mg->level[l].f);
+			gridfree(mg->level[l].r);
+		}
+		freeaxis(&mg->level[l].rows);
+		freeaxis(&mg->level[l].cols);
+	}
+	free(mg->level);
+	free(mg);
+}
+
+int mglevels(const multigrid *mg)
+{
+	return mg->levels;
+}
+
+// Neighbour sum of the level operator, its diagonal is rows.diag[i]+cols.diag[j]
+static inline double neighbours(const mglevel *lv, const double *u, int i, int j)
+{
+	const int p=lv->p;
+	return lv->rows.lo[i]*u[(i-1)*p+j]+lv->rows.hi[i]*u[(i+1)*p+j]
+		+lv->cols.lo[j]*u[i*p+j-1]+lv->cols.hi[j]*u[i*p+j+1];
+}
+
+// One red-black sweep of diag*u - neighbours = f, f == NULL means f = 0. omega = 1 is
+// Gauss-Seidel. On the finest level this is exactly the Jacobi stencil of jacobistep.
+static void smooth(const mglevel *lv, double *u, double omega)
+{
+	const int m=lv->m, n=lv->n, p=lv->p;
+	const double *f=lv->f;
+	for (int color=0;color<2;color++) {
+		for (int i=1;i<=m;i++) {
+			for (int j=1+(i+1+color)%2;j<=n;j+=2) {
+				const double sum = neighbours(lv,u,i,j)+(f == NULL ? 0.0 : f[i*p+j]);
+				const double gs = sum/(lv->rows.diag[i]+lv->cols.diag[j]);
+				u[i*p+j] += omega*(gs-u[i*p+j]);
+			}
+		}
+	}
+}
+
+// r = f - (diag*u - neighbours), returns the sum of the squared r / 4
+static double residual(const mglevel *lv, const double *u)
+{
+	const int m=lv->m, n=lv->n, p=lv->p;
+	const double *f=lv->f;
+	double *r=lv->r;
+	double dsq=0.0;
+	for (int i=1;i<=m;i++) {
+		for (int j=1;j<=n;j++) {
+			const double res = (f == NULL ? 0.0 : f[i*p+j])+neighbours(lv,u,i,j)
+				-(lv->rows.diag[i]+lv->cols.diag[j])*u[i*p+j];
+			r[i*p+j]=res;
+			dsq += 0.0625*res*res;
+		}
+	}
+	return dsq;
+}
+
+// Coarse cell (I, J) covers the fine cells 2I-1..2I x 2J-1..2J. The coarse spacing is
+// twice the fine one, so the right hand side is four times the average, i.e. the sum.
+static void restriction(mglevel *coarse, const mglevel *fine)
+{
+	const int mc=coarse->m, nc=coarse->n, pc=coarse->p, p=fine->p;
+	const double *r=fine->r;
+	for (int I=1;I<=mc;I++) {
+		for (int J=1;J<=nc;J++) {
+			const int i=2*I-1, j=2*J-1;
+			coarse->f[I*pc+J]=r[i*p+j]+r[i*p+j+1]+r[(i+1)*p+j]+r[(i+1)*p+j+1];
+		}
+	}
+}
+
+// Bilinear interpolation of the coarse correction: per axis the weight of the coarse cell
+// covering a fine cell and one minus it from the neighbour on the side of the fine cell.
+// The coarse boundaries are zero.
+static void prolongation(mglevel *fine, double *u, const mglevel *coarse)
+{
+	const int pc=coarse->p, m=fine->m, n=fine->n, p=fine->p;
+	const double *ec=coarse->u;
+	const double *wi=coarse->rows.weight, *wj=coarse->cols.weight;
+	for (int i=1;i<=m;i++) {
+		const int I=(i+1)/2;
+		const int In=i%2 ? I-1 : I+1;
+		for (int j=1;j<=n;j++) {
+			const int J=(j+1)/2;
+			const int Jn=j%2 ? J-1 : J+1;
+			u[i*p+j] += wi[i]*(wj[j]*ec[I*pc+J]+(1.0-wj[j])*ec[I*pc+Jn])
+				+(1.0-wi[i])*(wj[j]*ec[In*pc+J]+(1.0-wj[j])*ec[In*pc+Jn]);
+		}
+	}
+}
+
+static void vcycle(multigrid *mg, int l, double *u)
+{
+	mglevel *lv = &mg->level[l];
+
+	if (l == mg->levels-1) {
+		const double omega = soromega(lv->m,lv->n);
+		for (int s=0;s<COARSESWEEPS;s++) smooth(lv,u,omega);
+		return;
+	}
+
+	for (int s=0;s<PRESMOOTH;s++) smooth(lv,u,1.0);
+
+	mglevel *coarse = &mg->level[l+1];
+	residual(lv,u);
+	restriction(coarse,lv);
+
+	//the correction starts from zero, its boundaries are never written
+	for (int i=1;i<=coarse->m;i++) {
+		for (int j=1;j<=coarse->n;j++) {
+			coarse->u[i*coarse->p+j]=0.0;
+		}
+	}
+	vcycle(mg,l+1,coarse->u);
+	prolongation(lv,u,coarse);
+
+	for (int s=0;s<POSTSMOOTH;s++) smooth(lv,u,1.0);
+}
+
+double mgvcycle(multigrid *mg, double *psi)
+{
+	vcycle(mg,0,psi);
+	return residual(&mg->level[0],psi);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "grid.h"
+
+// Geometric multigrid for the stream function. Every level solves 4u - (sum of the
+// four neighbours) = f, the finest one with f = 0 on psi itself, the coarser ones
+// for the correction with zero boundaries. The grids are halved cell-centred, so
+// levels are added while m and n stay even and at least 4.
+struct multigrid;
+
+// Allocates the coarse levels for psi with the layout g, each with its own padded pitch.
+// They come from the arena if there is one, which needs mgarenabytes(g) for them.
+multigrid *mgcreate(cfdgrid g, gridarena *arena);
+size_t mgarenabytes(cfdgrid g);
+
+void mgfree(multigrid *mg);
+
+// Number of levels including the finest
+int mglevels(const multigrid *mg);
+
+// One V-cycle on psi in place, the boundaries of psi stay as they are. Returns the
+// sum of the squared Jacobi updates of the result, i.e. what deltasq would give for
+// one more Jacobi sweep.
+double mgvcycle(multigrid *mg, double *psi);
@@ -1,24 +1,274 @@
 #include <iostream>
+#include <iomanip>
+#include <fstream>
 #include <cstdlib>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include <mpi.h>
 
+// Point-to-point benchmarks run between ranks 0 and 1, the others wait for the collectives
+static constexpr int PING{0};
+static constexpr int PONG{1};
+static constexpr int WARMUP{10};
+// Every benchmark moves about this many bytes, so large messages need fewer iterations
+static constexpr long BYTES_PER_BENCH{64L << 20};
+static constexpr long MIN_ITERATIONS{20};
+static constexpr long MAX_ITERATIONS{10000};
+
+struct result {
+	std::string name;
+	// Message size in bytes, 0 where it doesn't apply
+	long bytes;
+	long iterations;
+	// One-way latency for point-to-point benchmarks, otherwise the time of one operation,
+	// the slowest rank for collectives
+	double us;
+	// bytes / us, 0 where it doesn't apply
+	double mb_per_s;
+};
+
+long iterations_for(long bytes) {
+	return std::clamp(BYTES_PER_BENCH / std::max(bytes, 1L), MIN_ITERATIONS, MAX_ITERATIONS);
+}
+
+// Message sizes from 1 byte to max_bytes in steps of 4
+std::vector<long> message_sizes(long max_bytes) {
+	std::vector<long> sizes;
+	for (long bytes{1}; bytes <= max_bytes; bytes *= 4) {
+		sizes.push_back(bytes);
+	}
+	return sizes;
+}
+
+// Blocking ping-pong, returns the mean one-way time in microseconds.
+double pingpong(int rank, std::vector<char>& buffer, long bytes, long iterations) {
+	const int count{static_cast<int>(bytes)};
+	double start{0.0};
+	for (long i{-WARMUP}; i < iterations; ++i) {
+		if (i == 0) start = MPI_Wtime();
+		if (rank == PING) {
+			MPI_Send(buffer.data(), count, MPI_BYTE, PONG, 0, MPI_COMM_WORLD);
+			MPI_Recv(buffer.data(), count, MPI_BYTE, PONG, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		} else {
+			MPI_Recv(buffer.data(), count, MPI_BYTE, PING, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			MPI_Send(buffer.data(), count, MPI_BYTE, PING, 0, MPI_COMM_WORLD);
+		}
+	}
+	return (MPI_Wtime() - start) / iterations / 2 * 1e6;
+}
+
+// Ping-pong where both sides poll with MPI_Iprobe and then receive what arrived,
+// the way the dz2 workers wait for tasks of unknown size.
+double pingpong_probe(int rank, std::vector<char>& buffer, long bytes, long iterations) {
+	const int count{static_cast<int>(bytes)};
+	const int peer{rank == PING ? PONG : PING};
+	auto receive{[&]() {
+		int has_msg{0};
+		MPI_Status status;
+		while (!has_msg) {
+			MPI_Iprobe(peer, 0, MPI_COMM_WORLD, &has_msg, &status);
+		}
+		int received;
+		MPI_Get_count(&status, MPI_BYTE, &received);
+		MPI_Recv(buffer.data(), received, MPI_BYTE, peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}};
+	double start{0.0};
+	for (long i{-WARMUP}; i < iterations; ++i) {
+		if (i == 0) start = MPI_Wtime();
+		if (rank == PING) {
+			MPI_Send(buffer.data(), count, MPI_BYTE, peer, 0, MPI_COMM_WORLD);
+			receive();
+		} else {
+			receive();
+			MPI_Send(buffer.data(), count, MPI_BYTE, peer, 0, MPI_COMM_WORLD);
+		}
+	}
+	return (MPI_Wtime() - start) / iterations / 2 * 1e6;
+}
+
+// Ping-pong where the receive for the next message is always posted before the send,
+// the way the dz1 philosophers keep persistent receives armed.
+double pingpong_preposted(int rank, std::vector<char>& buffer, long bytes, long iterations) {
+	const int count{static_cast<int>(bytes)};
+	const int peer{rank == PING ? PONG : PING};
+	std::vector<char> incoming(buffer.size());
+	MPI_Request receive;
+	MPI_Irecv(incoming.data(), count, MPI_BYTE, peer, 0, MPI_COMM_WORLD, &receive);
+	double start{0.0};
+	for (long i{-WARMUP}; i < iterations; ++i) {
+		if (i == 0) start = MPI_Wtime();
+		if (rank == PING) {
+			MPI_Send(buffer.data(), count, MPI_BYTE, peer, 0, MPI_COMM_WORLD);
+			MPI_Wait(&receive, MPI_STATUS_IGNORE);
+		} else {
+			MPI_Wait(&receive, MPI_STATUS_IGNORE);
+		}
+		// Arm the next receive before anything can arrive
+		const bool is_last{i + 1 == iterations};
+		if (!is_last || rank == PING) {
+			MPI_Irecv(incoming.data(), count, MPI_BYTE, peer, 0, MPI_COMM_WORLD, &receive);
+		}
+		if (rank == PONG) {
+			MPI_Send(buffer.data(), count, MPI_BYTE, peer, 0, MPI_COMM_WORLD);
+		}
+	}
+	const double elapsed{MPI_Wtime() - start};
+	if (rank == PING) {
+		// Nothing answers the receive armed after the last reply
+		MPI_Cancel(&receive);
+		MPI_Wait(&receive, MPI_STATUS_IGNORE);
+	}
+	return elapsed / iterations / 2 * 1e6;
+}
+
+// Latency of one remote atomic increment, flushed to make it complete at the target.
+double fetch_and_op(int rank, int size, long iterations) {
+	long* base;
+	MPI_Win win;
+	MPI_Win_allocate(sizeof(long), sizeof(long), MPI_INFO_NULL, MPI_COMM_WORLD, &base, &win);
+	*base = 0;
+	MPI_Barrier(MPI_COMM_WORLD);
+	// Without a second rank the counter is local, which still measures the call overhead
+	const int target{size > 1 ? PONG : PING};
+	double elapsed{0.0};
+	MPI_Win_lock_all(0, win);
+	if (rank == PING) {
+		const long one{1};
+		long previous;
+		double start{0.0};
+		for (long i{-WARMUP}; i < iterations; ++i) {
+			if (i == 0) start = MPI_Wtime();
+			MPI_Fetch_and_op(&one, &previous, MPI_LONG, target, 0, MPI_SUM, win);
+			MPI_Win_flush(target, win);
+		}
+		elapsed = MPI_Wtime() - start;
+	}
+	MPI_Win_unlock_all(win);
+	MPI_Win_free(&win);
+	return elapsed / iterations * 1e6;
+}
+
+// Runs op and returns the time of one call on the slowest rank, valid on rank 0.
+template <typename F>
+double collective(long iterations, F op) {
+	for (long i{0}; i < WARMUP; ++i) op();
+	MPI_Barrier(MPI_COMM_WORLD);
+	const double start{MPI_Wtime()};
+	for (long i{0}; i < iterations; ++i) op();
+	const double local{(MPI_Wtime() - start) / iterations * 1e6};
+	double slowest;
+	MPI_Reduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	return slowest;
+}
+
+void write_json(const std::string& filename, int size, const std::vector<result>& results) {
+	std::ofstream file(filename);
+	file << std::setprecision(17);
+	file << "{\"ranks\": " << size << ", \"results\": [\n";
+	for (std::size_t i{0}; i < results.size(); ++i) {
+		const result& r{results[i]};
+		file << "\t{\"name\": \"" << r.name << "\", \"bytes\": " << r.bytes << ", \"iterations\": " << r.iterations
+			<< ", \"us\": " << r.us << ", \"mb_per_s\": " << r.mb_per_s << "}";
+		file << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	file << "]}\n";
+}
+
+void write_markdown(std::ostream& out, const std::vector<result>& results) {
+	out << "| Benchmark | Bytes | Iterations | Time (us) | Bandwidth (MB/s) |\n";
+	out << "| ---       | ---:  | ---:       | ---:      | ---:             |\n";
+	for (const result& r : results) {
+		out << "| " << r.name << " | " << r.bytes << " | " << r.iterations << " | " << std::fixed << std::setprecision(3) << r.us
+			<< " | " << std::setprecision(1) << r.mb_per_s << " |\n";
+	}
+}
+
 int main(int argc, char* argv[]) {
 	MPI_Init(nullptr, nullptr);
 
-	int world_size;
-	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	int size, rank;
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-	int world_rank;
-	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+	if (argc < 2) {
+		if (rank == 0) {
+			std::cerr << argv[0] << " <report.json> [max_bytes]" << std::endl;
+		}
+		MPI_Finalize();
+		return EXIT_FAILURE;
+	}
+	const std::string report{argv[1]};
+	const long max_bytes{argc >= 3 ? std::atol(argv[2]) : 4L << 20};
 
-	char processor_name[MPI_MAX_PROCESSOR_NAME];
+	// Where the ranks run, the results only mean something together with the placement
+	char processor_name[MPI_MAX_PROCESSOR_NAME]{};
 	int name_len;
 	MPI_Get_processor_name(processor_name, &name_len);
+	std::vector<char> names(rank == 0 ? size * MPI_MAX_PROCESSOR_NAME : 0);
+	MPI_Gather(processor_name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, names.data(), MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 0, MPI_COMM_WORLD);
+	if (rank == 0) {
+		for (int r{0}; r < size; ++r) {
+			std::cout << "rank " << r << " on " << &names[r * MPI_MAX_PROCESSOR_NAME] << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
+	std::vector<result> results;
+	const std::vector<long> sizes{message_sizes(max_bytes)};
+	std::vector<char> buffer(std::max(max_bytes, 1L));
+
+	if (size < 2 && rank == 0) {
+		std::cerr << "point-to-point benchmarks need at least 2 ranks, skipping them" << std::endl;
+	}
+	const bool is_pair{size >= 2 && rank <= PONG};
+	for (const long bytes : sizes) {
+		if (!is_pair) break;
+		const long iterations{iterations_for(bytes)};
+		const double us{pingpong(rank, buffer, bytes, iterations)};
+		results.push_back(result{"pingpong", bytes, iterations, us, bytes / us});
+	}
+	for (const long bytes : sizes) {
+		if (!is_pair || bytes > 64L << 10) break;
+		const long iterations{iterations_for(bytes)};
+		const double probe_us{pingpong_probe(rank, buffer, bytes, iterations)};
+		results.push_back(result{"iprobe_recv", bytes, iterations, probe_us, bytes / probe_us});
+		const double preposted_us{pingpong_preposted(rank, buffer, bytes, iterations)};
+		results.push_back(result{"preposted_irecv", bytes, iterations, preposted_us, bytes / preposted_us});
+	}
+
+	results.push_back(result{"fetch_and_op", sizeof(long), MAX_ITERATIONS, fetch_and_op(rank, size, MAX_ITERATIONS), 0.0});
+
+	// Collectives over all ranks
+	results.push_back(result{"barrier", 0, MAX_ITERATIONS, collective(MAX_ITERATIONS, []() {
+		MPI_Barrier(MPI_COMM_WORLD);
+	}), 0.0});
+	for (const long bytes : sizes) {
+		const long iterations{iterations_for(bytes * size)};
+		const double us{collective(iterations, [&]() {
+			MPI_Bcast(buffer.data(), static_cast<int>(bytes), MPI_BYTE, 0, MPI_COMM_WORLD);
+		})};
+		results.push_back(result{"bcast", bytes, iterations, us, bytes / us});
+	}
+	std::vector<double> values(std::max(max_bytes / static_cast<long>(sizeof(double)), 1L));
+	std::vector<double> sums(values.size());
+	for (const long bytes : sizes) {
+		if (bytes < static_cast<long>(sizeof(double))) continue;
+		const int count{static_cast<int>(bytes / sizeof(double))};
+		const long iterations{iterations_for(bytes * size)};
+		const double us{collective(iterations, [&]() {
+			MPI_Allreduce(values.data(), sums.data(), count, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+		})};
+		results.push_back(result{"allreduce", bytes, iterations, us, bytes / us});
+	}
 
-	std::cout << "Hello from processor " << processor_name
-		<< ", rank " << world_rank
-		<< " out of " << world_size << " processors" << std::endl;
+	// Only rank 0 holds the complete results, the point-to-point ones are timed on it as well
+	if (rank == 0) {
+		write_json(report, size, results);
+		write_markdown(std::cout, results);
+	}
 
 	MPI_Finalize();
 